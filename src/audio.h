@@ -10,6 +10,17 @@
 #include "psx.h"
 #include "psx/stream.h"
 
+//Audio stream channel roles, written into the .VAG by funkinvagpak
+typedef enum
+{
+    AudioRole_Inst,
+    AudioRole_Vocal,    //Vocals of both singers in one stem
+    AudioRole_Player,   //Vocals of the player only
+    AudioRole_Opponent, //Vocals of the opponent only
+} AudioRole;
+
+#define AUDIO_ROLE_MASK(role) (1 << (role))
+
 //Audio functions
 void Audio_ResetChannels(void);
 void Audio_Init(void);
@@ -22,6 +33,7 @@ uint64_t Audio_GetTime(int unit);
 uint32_t Audio_GetInitialTime(void);
 bool Audio_IsPlaying(void);
 void Audio_SetVolume(uint8_t i, uint16_t vol_left, uint16_t vol_right);
+void Audio_SetRoleVolume(uint32_t role_mask, uint16_t vol);
 
 void Audio_ClearAlloc(void);
 uint32_t Audio_LoadVAGData(uint32_t *sound, uint32_t sound_size);
@@ -15,8 +15,8 @@ void Char_SetFrame(void *user, uint8_t frame)
 {
     Character *this = (Character*)user;
 
-    //Check if this is a new frame
-    if (frame != this->frame)
+    //Check if this is a new frame, skipping frames missing from the character file
+    if (frame != this->frame && frame < this->num_frames)
     {
         //Check if new art shall be loaded
         const CharFrame *cframe = &this->frames[this->frame = frame];
@@ -53,6 +53,7 @@ Character *Character_FromFile(Character *this, const char *path, fixed_t x, fixe
     offset += (sizeof(Animation) * tmphdr->size_animation);
     printf("offset %d, \n", offset);
     this->frames = (const CharFrame *)&this->file[offset];
+    this->num_frames = tmphdr->size_frames;
     offset += (tmphdr->size_frames * sizeof(CharFrame));
     printf("offset %d, \n", offset);
     
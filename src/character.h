@@ -59,6 +59,7 @@ typedef struct Character
     
     //Animation state
     const CharFrame *frames;
+    uint16_t num_frames;
     Animatable animatable;
     fixed_t sing_end;
     uint16_t pad_held;
@@ -19,7 +19,9 @@
 #include "save.h"
 
 #include <stdlib.h>
-#include <hwregs_c.h>
+#ifndef PSXF_PC
+    #include <hwregs_c.h>
+#endif
 
 //Game loop
 GameLoop gameloop;
@@ -30,11 +32,17 @@ char error_msg[0x200];
 
 void ErrorLock(void)
 {
+#ifdef PSXF_PC
+    //Nobody is watching the screen, report and bail out
+    fprintf(stderr, "A fatal error has occured:\n\n%s\n", error_msg);
+    exit(1);
+#else
     while (1)
     {
         FntPrint(-1, "A fatal error has occured:\n\n%s\n", error_msg);
         Gfx_Flip();
     }
+#endif
 }
 
 //Entry point                                                                             
@@ -45,17 +53,21 @@ int main(int argc, char **argv)
     my_argv = argv;
 
     //Initialize system
+#ifndef PSXF_PC
     ResetGraph(0);
+#endif
     PSX_Init();
 
     Gfx_Init();
     STR_Init();
     Pad_Init();
+#ifndef PSXF_PC
     InitCARD(1);
     StartPAD();
     StartCARD();
     _bu_init(); 
     ChangeClearPAD(0);
+#endif
     IO_Init();
     Audio_Init();
     Timer_Init();
@@ -101,7 +113,7 @@ int main(int argc, char **argv)
                 break;
         }
 
-#ifndef NDEBUG
+#if !defined(NDEBUG) && !defined(PSXF_PC)
         HeapUsage heap;
         GetHeapUsage(&heap);
 
@@ -122,5 +134,11 @@ int main(int argc, char **argv)
         Timer_CalcFPS();
     }
     
+    //Deinitialize system
+    Pad_Quit();
+    Gfx_Quit();
+    IO_Quit();
+    PSX_Quit();
+    
     return 0;
 }
@@ -280,7 +280,11 @@ void Menu_Load(MenuPage page)
         case MenuPage_Opening:
             //Get funny message to use
             //Do this here so timing is less reliant on VSync
+#ifdef PSXF_PC
+            menu.page_state.opening.funny_message = Timer_GetTime() % COUNT_OF(funny_messages); //virtual clock seeding
+#else
             menu.page_state.opening.funny_message = ((*((volatile uint32_t*)0xBF801120)) >> 3) % COUNT_OF(funny_messages); //sysclk seeding
+#endif
             break;
         default:
             break;
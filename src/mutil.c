@@ -32,6 +32,12 @@ static const int16_t sine_table[0x140] = {
     236,238,241,243,244,246,248,249,251,252,253,254,254,255,255,255,
 };
 
+//CRC-32 table, one entry per nibble
+static const uint32_t crc_table[0x10] = {
+    0x00000000,0x1DB71064,0x3B6E20C8,0x26D930AC,0x76DC4190,0x6B6B51F4,0x4DB26158,0x5005713C,
+    0xEDB88320,0xF00F9344,0xD6D6A3E8,0xCB61B38C,0x9B64C2B0,0x86D3D2D4,0xA00AE278,0xBDBDF21C,
+};
+
 //Math utility functions
 int16_t MUtil_Sin(uint8_t x)
 {
@@ -50,3 +56,16 @@ void MUtil_RotatePoint(POINT *p, int16_t s, int16_t c)
     p->x = ((px * c) >> 8) - ((py * s) >> 8);
     p->y = ((px * s) >> 8) + ((py * c) >> 8);
 }
+
+uint32_t MUtil_CRC32(const void *data, size_t size)
+{
+    const uint8_t *byte = (const uint8_t*)data;
+    uint32_t crc = 0xFFFFFFFF;
+    while (size--)
+    {
+        crc ^= *byte++;
+        crc = (crc >> 4) ^ crc_table[crc & 0xF];
+        crc = (crc >> 4) ^ crc_table[crc & 0xF];
+    }
+    return ~crc;
+}
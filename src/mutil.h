@@ -18,5 +18,6 @@ int16_t MUtil_Sin(uint8_t x);
 int16_t MUtil_Cos(uint8_t x);
 void MUtil_RotatePoint(POINT *p, int16_t s, int16_t c);
 fixed_t MUtil_Pull(fixed_t a, fixed_t b, fixed_t t);
+uint32_t MUtil_CRC32(const void *data, size_t size);
 
 #endif
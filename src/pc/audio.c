@@ -0,0 +1,188 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include "../audio.h"
+#include "../vag.h"
+
+#include <stdlib.h>
+#include "../io.h"
+#include "../timer.h"
+#include "../main.h"
+#include "pc.h"
+
+//Nothing is played on PC, streams only keep time against the virtual clock
+
+typedef struct {
+    uint32_t samples, sample_rate;
+    bool loop, active;
+
+    uint64_t start_time;    // Virtual clock when playback was last started
+    uint64_t played_before; // Samples played before the last start
+} PCStreamContext;
+
+static PCStreamContext stream_ctx;
+static uint16_t channel_vol[24][2];
+static uint16_t stream_gain[24];
+static uint8_t stream_role[24];
+static int stream_channels = 0;
+
+static void Audio_SetStreamVolume(int ch, uint16_t vol) {
+    int pan = stream_role[ch] >> 4;
+    Audio_SetVolume(ch, (pan != VAG_PAN_RIGHT) ? vol : 0x0000, (pan != VAG_PAN_LEFT) ? vol : 0x0000);
+}
+
+/* SPU RAM accounting */
+
+#define VAG_HEADER_SIZE  48
+#define ALLOC_START_ADDR 0x1010
+
+static uint32_t audio_alloc_ptr = 0;
+static uint32_t buffers_size = 0;
+
+void Audio_ClearAlloc(void) {
+    audio_alloc_ptr = ALLOC_START_ADDR;
+}
+
+void Audio_ResetChannels(void) {
+    memset(channel_vol, 0, sizeof(channel_vol));
+}
+
+void Audio_Init(void) {
+    Audio_ResetChannels();
+    Audio_ClearAlloc();
+    memset(&stream_ctx, 0, sizeof(stream_ctx));
+
+    for (int i = 0; i < 24; i++)
+        stream_gain[i] = 0x1000;
+}
+
+static uint64_t Audio_GetSamplesPlayed(void) {
+    uint64_t played = stream_ctx.played_before;
+
+    if (stream_ctx.active) {
+        uint64_t now = Timer_GetTime();
+        if (now > stream_ctx.start_time)
+            played += (now - stream_ctx.start_time) * stream_ctx.sample_rate / TICKS_PER_SEC;
+    }
+
+    if (stream_ctx.loop && stream_ctx.samples)
+        played %= stream_ctx.samples;
+    else if (played > stream_ctx.samples)
+        played = stream_ctx.samples;
+    return played;
+}
+
+bool Audio_FeedStream(void) {
+    return false;
+}
+
+void Audio_LoadStream(const char *path, bool loop) {
+    Audio_ClearAlloc();
+    CdlFILE file;
+    IO_FindFile(&file, path);
+
+    IO_Data data = IO_ReadFile(&file);
+    VAG_Header *vag = (VAG_Header *) data;
+
+    int num_channels = vag->channels ? vag->channels : 2;
+    buffers_size = 0;
+    for (int ch = 0; ch < num_channels && ch < 24; ch++)
+        buffers_size += (vag->interleave * ((vag->flags & VAG_FLAG_PITCH) ? vag->pitch[ch] : 0x1000)) >> 12;
+    buffers_size *= 2;
+    for (int ch = 0; ch < 24; ch++)
+        stream_gain[ch] = (ch < num_channels && (vag->flags & VAG_FLAG_GAIN)) ? vag->gain[ch] : 0x1000;
+    for (int ch = 0; ch < 24; ch++) {
+        if (vag->flags & VAG_FLAG_ROLE)
+            stream_role[ch] = vag->role[ch];
+        else if (ch == 2)
+            stream_role[ch] = AudioRole_Vocal | (VAG_PAN_CENTER << 4);
+        else
+            stream_role[ch] = AudioRole_Inst | ((ch % 2) << 4);
+    }
+    stream_channels = (num_channels < 24) ? num_channels : 24;
+    for (int ch = 0; ch < stream_channels; ch++)
+        Audio_SetStreamVolume(ch, 0x3fff);
+
+    memset(&stream_ctx, 0, sizeof(stream_ctx));
+    stream_ctx.samples     = (SWAP_ENDIAN(vag->size) / 16) * 28;
+    stream_ctx.sample_rate = SWAP_ENDIAN(vag->sample_rate);
+    stream_ctx.loop        = loop;
+    free(data);
+}
+
+void Audio_StartStream(bool resume) {
+    if (!resume)
+        stream_ctx.played_before = 0;
+    stream_ctx.start_time = Timer_GetTime();
+    stream_ctx.active = true;
+}
+
+void Audio_StopStream(void) {
+    stream_ctx.played_before = Audio_GetSamplesPlayed();
+    stream_ctx.active = false;
+}
+
+void Audio_DestroyStream(void) {
+    memset(&stream_ctx, 0, sizeof(stream_ctx));
+    buffers_size = 0;
+}
+
+bool Audio_IsPlaying(void) {
+    return stream_ctx.active && (stream_ctx.loop || Audio_GetSamplesPlayed() < stream_ctx.samples);
+}
+
+uint64_t Audio_GetTime(int unit) {
+    if (stream_ctx.sample_rate != 0)
+        return Audio_GetSamplesPlayed() * ((uint64_t) unit) / ((uint64_t) stream_ctx.sample_rate);
+
+    return 0;
+}
+
+uint32_t Audio_GetInitialTime(void) {
+    if (stream_ctx.sample_rate != 0)
+        return stream_ctx.samples / stream_ctx.sample_rate;
+    else return 0;
+}
+
+void Audio_SetVolume(uint8_t i, uint16_t vol_left, uint16_t vol_right) {
+    channel_vol[i][0] = (vol_left  * stream_gain[i]) >> 12;
+    channel_vol[i][1] = (vol_right * stream_gain[i]) >> 12;
+}
+
+void Audio_SetRoleVolume(uint32_t role_mask, uint16_t vol) {
+    for (int ch = 0; ch < stream_channels; ch++) {
+        if (role_mask & AUDIO_ROLE_MASK(stream_role[ch] & 0xf))
+            Audio_SetStreamVolume(ch, vol);
+    }
+}
+
+void Audio_PlaySound(uint32_t addr, int volume) {
+    (void)addr;
+    (void)volume;
+}
+
+uint32_t Audio_LoadSound(const char *path) {
+    //Load Sound File
+    CdlFILE sfx_file;
+    IO_FindFile(&sfx_file, path);
+    IO_Data sfx_data = IO_ReadFile(&sfx_file);
+
+    // subtract size of .vag header (48 bytes), round to 64 bytes
+    uint32_t xfer_size = ((sfx_file.size - VAG_HEADER_SIZE) + 63) & 0xffffffc0;
+
+    // allocate SPU memory for sound, keeping the same layout as the console
+    audio_alloc_ptr += buffers_size;
+    uint32_t addr = audio_alloc_ptr;
+    audio_alloc_ptr += xfer_size;
+
+    if (audio_alloc_ptr > 0x80000) {
+        sprintf(error_msg, "[Audio_LoadSound] SPU RAM overflow! (%d bytes overflowing)", audio_alloc_ptr - 0x80000);
+        ErrorLock();
+    }
+
+    free(sfx_data);
+    return addr;
+}
@@ -0,0 +1,401 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include "../gfx.h"
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include "../main.h"
+#include "../stage.h"
+#include "pc.h"
+
+//Primitives are recorded instead of drawn, one list per buffer like the PSX
+#define PC_MAX_PRIMS (PC_PRIBUFF_SIZE / PC_SIZEOF_DR_TPAGE)
+#define PC_TEXT_SIZE 0x800
+
+//Gfx state
+uint8_t db;
+PC_GfxStats pc_gfx_stats;
+
+static PC_Prim prims[2][PC_MAX_PRIMS];
+static size_t prim_count[2];
+static uint32_t prim_types[2][PC_PrimType_Max];
+static size_t pribuff_used[2];
+static char text[2][PC_TEXT_SIZE];
+static size_t text_len[2];
+
+//Texture page and CLUT encoding, same as PSn00bSDK's getTPage() and getClut()
+#define PC_TPAGE(tp, abr, x, y) ((((x) & 0x3C0) >> 6) | (((y) & 0x100) >> 4) | (((y) & 0x200) << 2) | (((abr) & 0x3) << 5) | (((tp) & 0x3) << 7))
+#define PC_CLUT(x, y) (((y) << 6) | (((x) >> 4) & 0x3F))
+
+//Internal gfx functions
+static PC_Prim *Gfx_AddPrim(PC_PrimType type, size_t size)
+{
+    prim_types[db][type]++;
+    pribuff_used[db] += size;
+
+    //Still count primitives that don't fit so overflows can be measured
+    if (prim_count[db] >= PC_MAX_PRIMS)
+        return NULL;
+    PC_Prim *prim = &prims[db][prim_count[db]++];
+    memset(prim, 0, sizeof(PC_Prim));
+    prim->type = type;
+    prim->semi = 0xFF;
+    return prim;
+}
+
+static void Gfx_SetPrimXYWH(PC_Prim *prim, int16_t x, int16_t y, int16_t w, int16_t h)
+{
+    prim->p[0].x = x;     prim->p[0].y = y;
+    prim->p[1].x = x + w; prim->p[1].y = y;
+    prim->p[2].x = x;     prim->p[2].y = y + h;
+    prim->p[3].x = x + w; prim->p[3].y = y + h;
+}
+
+static void Gfx_AddTPage(uint16_t tpage)
+{
+    PC_Prim *prim = Gfx_AddPrim(PC_PrimType_TPage, PC_SIZEOF_DR_TPAGE);
+    if (prim != NULL)
+        prim->tpage = tpage;
+}
+
+//PC functions
+const PC_Prim *PC_GetPrims(size_t *count)
+{
+    //Last completed frame
+    *count = prim_count[db ^ 1];
+    return prims[db ^ 1];
+}
+
+const char *PC_GetText(void)
+{
+    return text[db ^ 1];
+}
+
+int PC_FntPrint(int id, const char *fmt, ...)
+{
+    (void)id;
+
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(text[db] + text_len[db], PC_TEXT_SIZE - text_len[db], fmt, args);
+    va_end(args);
+
+    if (len > 0)
+    {
+        text_len[db] += len;
+        if (text_len[db] >= PC_TEXT_SIZE)
+            text_len[db] = PC_TEXT_SIZE - 1;
+    }
+    return len;
+}
+
+//Gfx functions
+void Gfx_Init(void)
+{
+    int width = stage.prefs.widescreen ? 512 : 320;
+
+    //Initialize display environment
+    memset(stage.disp, 0, sizeof(stage.disp));
+    memset(stage.draw, 0, sizeof(stage.draw));
+    stage.disp[0].disp = (RECT){0, 0, width, 240};
+    stage.disp[1].disp = (RECT){0, 240, width, 240};
+    stage.draw[0].clip = (RECT){0, 240, width, 240};
+    stage.draw[1].clip = (RECT){0, 0, width, 240};
+
+    //Set draw background
+    stage.draw[0].isbg = 1;
+    stage.draw[1].isbg = 1;
+
+    //Initialize drawing state
+    db = 0;
+    for (int i = 0; i < 2; i++)
+    {
+        prim_count[i] = 0;
+        pribuff_used[i] = 0;
+        memset(prim_types[i], 0, sizeof(prim_types[i]));
+        text[i][0] = '\0';
+        text_len[i] = 0;
+    }
+}
+
+void Gfx_ScreenSetup(void) {
+    screen.SCREEN_WIDTH   = stage.prefs.widescreen ? 512 : 320;
+    screen.SCREEN_HEIGHT  = 240;
+    screen.SCREEN_WIDTH2  = (screen.SCREEN_WIDTH >> 1);
+    screen.SCREEN_HEIGHT2 = (screen.SCREEN_HEIGHT >> 1);
+
+    screen.SCREEN_WIDEADD = 0; // ???
+    screen.SCREEN_TALLADD = 0; // ???
+    screen.SCREEN_WIDEADD2 = (screen.SCREEN_WIDEADD >> 1);
+    screen.SCREEN_TALLADD2 = (screen.SCREEN_TALLADD >> 1);
+
+    screen.SCREEN_WIDEOADD = (screen.SCREEN_WIDEADD > 0 ? screen.SCREEN_WIDEADD : 0);
+    screen.SCREEN_TALLOADD = (screen.SCREEN_TALLADD > 0 ? screen.SCREEN_TALLADD : 0);
+    screen.SCREEN_WIDEOADD2 = (screen.SCREEN_WIDEOADD >> 1);
+    screen.SCREEN_TALLOADD2 = (screen.SCREEN_TALLOADD >> 1);
+
+    Gfx_Init();
+}
+
+void Gfx_DrawText(int x, int y, int z, const char *str)
+{
+    (void)z;
+
+    //FntSort uses an 8x8 sprite per character and a texture page change
+    size_t len = strlen(str);
+    PC_Prim *prim = Gfx_AddPrim(PC_PrimType_Text, len * PC_SIZEOF_SPRT_8 + PC_SIZEOF_DR_TPAGE);
+    if (prim != NULL)
+        Gfx_SetPrimXYWH(prim, x, y, len * 8, 8);
+}
+
+void Gfx_Quit(void)
+{
+
+}
+
+void Gfx_Flip(void)
+{
+    //Update stats from the finished frame
+    pc_gfx_stats.frame++;
+    memcpy(pc_gfx_stats.prims, prim_types[db], sizeof(pc_gfx_stats.prims));
+    pc_gfx_stats.pribuff_used = pribuff_used[db];
+    if (pribuff_used[db] > pc_gfx_stats.pribuff_peak)
+        pc_gfx_stats.pribuff_peak = pribuff_used[db];
+    if (pribuff_used[db] > PC_PRIBUFF_SIZE)
+        pc_gfx_stats.pribuff_overflows++;
+
+    //Wait for "VSync"
+    PC_StepClock();
+
+    //Flip buffers
+    db ^= 1;
+    prim_count[db] = 0;
+    pribuff_used[db] = 0;
+    memset(prim_types[db], 0, sizeof(prim_types[db]));
+    text[db][0] = '\0';
+    text_len[db] = 0;
+}
+
+void Gfx_SetClear(uint8_t r, uint8_t g, uint8_t b)
+{
+    stage.draw[0].r0 = stage.draw[1].r0 = r;
+    stage.draw[0].g0 = stage.draw[1].g0 = g;
+    stage.draw[0].b0 = stage.draw[1].b0 = b;
+}
+
+void Gfx_EnableClear(void)
+{
+    stage.draw[0].isbg = stage.draw[1].isbg = 1;
+}
+
+void Gfx_DisableClear(void)
+{
+    stage.draw[0].isbg = stage.draw[1].isbg = 0;
+}
+
+void Gfx_LoadTex(Gfx_Tex *tex, IO_Data data, Gfx_LoadTex_Flag flag)
+{
+    //Catch NULL data
+    if (data == NULL)
+    {
+        sprintf(error_msg, "[Gfx_LoadTex] data is NULL");
+        ErrorLock();
+    }
+
+    //Read TIM information
+    const uint32_t *tim = (const uint32_t*)data;
+    uint32_t mode = tim[1];
+    const uint32_t *block = &tim[2];
+
+    RECT crect = {0, 0, 0, 0};
+    if (mode & 0x8)
+    {
+        const uint16_t *cblock = (const uint16_t*)&block[1];
+        crect = (RECT){cblock[0], cblock[1], cblock[2], cblock[3]};
+        block = (const uint32_t*)((const uint8_t*)block + block[0]);
+    }
+    const uint16_t *pblock = (const uint16_t*)&block[1];
+    RECT prect = {pblock[0], pblock[1], pblock[2], pblock[3]};
+
+    //"Upload" pixel data
+    if (!(flag & GFX_LOADTEX_NOTEX))
+    {
+        if (tex != NULL)
+        {
+            tex->tim_mode = mode;
+            tex->tim_prect = prect;
+            tex->tpage = PC_TPAGE(mode & 0x3, 0, prect.x, prect.y);
+        }
+    }
+
+    //"Upload" CLUT if present
+    if ((mode & 0x8) && !(flag & GFX_LOADTEX_NOCLUT))
+    {
+        if (tex != NULL)
+        {
+            tex->tim_crect = crect;
+            tex->clut = PC_CLUT(crect.x, crect.y);
+        }
+    }
+
+    //Free data
+    if (flag & GFX_LOADTEX_FREE)
+        free(data);
+}
+
+void Gfx_DrawRect(const RECT *rect, uint8_t r, uint8_t g, uint8_t b)
+{
+    //Add quad
+    PC_Prim *quad = Gfx_AddPrim(PC_PrimType_Rect, PC_SIZEOF_POLY_F4);
+    if (quad == NULL)
+        return;
+    Gfx_SetPrimXYWH(quad, rect->x, rect->y, rect->w, rect->h);
+    quad->r = r;
+    quad->g = g;
+    quad->b = b;
+}
+
+void Gfx_BlendRect(const RECT *rect, uint8_t r, uint8_t g, uint8_t b, uint8_t mode)
+{
+    //Add quad
+    PC_Prim *quad = Gfx_AddPrim(PC_PrimType_Rect, PC_SIZEOF_POLY_F4);
+    if (quad != NULL)
+    {
+        Gfx_SetPrimXYWH(quad, rect->x, rect->y, rect->w, rect->h);
+        quad->r = r;
+        quad->g = g;
+        quad->b = b;
+        quad->semi = mode;
+    }
+
+    //Add tpage change (this controls transparency mode)
+    Gfx_AddTPage(PC_TPAGE(0, mode, 0, 0));
+}
+
+void Gfx_BlendTex(Gfx_Tex *tex, const RECT *src, const RECT *dst, uint8_t mode)
+{
+    //Manipulate rects to comply with GPU restrictions
+    RECT csrc, cdst;
+    csrc = *src;
+    cdst = *dst;
+
+    if (dst->w < 0)
+        csrc.x--;
+    if (dst->h < 0)
+        csrc.y--;
+
+    if ((csrc.x + csrc.w) >= 0x100)
+    {
+        csrc.w = 0xFF - csrc.x;
+        cdst.w = cdst.w * csrc.w / src->w;
+    }
+    if ((csrc.y + csrc.h) >= 0x100)
+    {
+        csrc.h = 0xFF - csrc.y;
+        cdst.h = cdst.h * csrc.h / src->h;
+    }
+
+    //Add quad
+    PC_Prim *quad = Gfx_AddPrim(PC_PrimType_Quad, PC_SIZEOF_POLY_FT4);
+    if (quad == NULL)
+        return;
+    quad->src = csrc;
+    Gfx_SetPrimXYWH(quad, cdst.x, cdst.y, cdst.w, cdst.h);
+    quad->r = quad->g = quad->b = 0x80;
+    quad->semi = mode;
+    quad->tpage = tex->tpage;
+    quad->clut = tex->clut;
+}
+
+void Gfx_BlitTexCol(Gfx_Tex *tex, const RECT *src, int32_t x, int32_t y, uint8_t r, uint8_t g, uint8_t b)
+{
+    //Add sprite
+    PC_Prim *sprt = Gfx_AddPrim(PC_PrimType_Sprt, PC_SIZEOF_SPRT);
+    if (sprt != NULL)
+    {
+        sprt->src = *src;
+        Gfx_SetPrimXYWH(sprt, x, y, src->w, src->h);
+        sprt->r = r;
+        sprt->g = g;
+        sprt->b = b;
+        sprt->clut = tex->clut;
+    }
+
+    //Add tpage change (TODO: reduce tpage changes)
+    Gfx_AddTPage(tex->tpage);
+}
+
+void Gfx_DrawTexCol(Gfx_Tex *tex, const RECT *src, const RECT *dst, uint8_t r, uint8_t g, uint8_t b)
+{
+    //Manipulate rects to comply with GPU restrictions
+    RECT csrc, cdst;
+    csrc = *src;
+    cdst = *dst;
+
+    if (dst->w < 0)
+        csrc.x--;
+    if (dst->h < 0)
+        csrc.y--;
+
+    if ((csrc.x + csrc.w) >= 0x100)
+    {
+        csrc.w = 0xFF - csrc.x;
+        cdst.w = cdst.w * csrc.w / src->w;
+    }
+    if ((csrc.y + csrc.h) >= 0x100)
+    {
+        csrc.h = 0xFF - csrc.y;
+        cdst.h = cdst.h * csrc.h / src->h;
+    }
+
+    //Add quad
+    PC_Prim *quad = Gfx_AddPrim(PC_PrimType_Quad, PC_SIZEOF_POLY_FT4);
+    if (quad == NULL)
+        return;
+    quad->src = (RECT){src->x, csrc.y, csrc.w, csrc.h};
+    Gfx_SetPrimXYWH(quad, cdst.x, cdst.y, cdst.w, cdst.h);
+    quad->r = r;
+    quad->g = g;
+    quad->b = b;
+    quad->tpage = tex->tpage;
+    quad->clut = tex->clut;
+}
+
+void Gfx_DrawTexArbCol(Gfx_Tex *tex, const RECT *src, const POINT *p0, const POINT *p1, const POINT *p2, const POINT *p3, uint8_t r, uint8_t g, uint8_t b)
+{
+    //Add quad
+    PC_Prim *quad = Gfx_AddPrim(PC_PrimType_Quad, PC_SIZEOF_POLY_FT4);
+    if (quad == NULL)
+        return;
+    quad->src = *src;
+    quad->p[0] = *p0;
+    quad->p[1] = *p1;
+    quad->p[2] = *p2;
+    quad->p[3] = *p3;
+    quad->r = r;
+    quad->g = g;
+    quad->b = b;
+    quad->tpage = tex->tpage;
+    quad->clut = tex->clut;
+}
+
+void Gfx_BlendTexArb(Gfx_Tex *tex, const RECT *src, const POINT *p0, const POINT *p1, const POINT *p2, const POINT *p3, uint8_t mode)
+{
+    //Add quad
+    PC_Prim *quad = Gfx_AddPrim(PC_PrimType_Quad, PC_SIZEOF_POLY_FT4);
+    if (quad == NULL)
+        return;
+    quad->src = *src;
+    quad->p[0] = *p0;
+    quad->p[1] = *p1;
+    quad->p[2] = *p2;
+    quad->p[3] = *p3;
+    quad->r = quad->g = quad->b = 0x80;
+    quad->semi = 1;
+    quad->tpage = tex->tpage | PC_TPAGE(0, mode, 0, 0);
+    quad->clut = tex->clut;
+}
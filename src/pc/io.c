@@ -0,0 +1,293 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include "../io.h"
+
+#include <stdlib.h>
+#include <ctype.h>
+#include <strings.h>
+#include "../audio.h"
+#include "../main.h"
+#include "pc.h"
+
+//The CD layout is described by funkin.xml, map disc paths back to the files it was built from
+#define IO_MAX_FILES 512
+#define IO_PATH_SIZE 256
+
+typedef struct
+{
+    char cd_path[32];          //Lowercase, '/' separated, no version
+    char host_path[IO_PATH_SIZE];
+} IO_HostFile;
+
+static IO_HostFile io_files[IO_MAX_FILES];
+static uint32_t io_num_files;
+
+//Internal IO functions
+static const char *IO_GetAttribute(const char *tag, const char *tag_end, const char *name, char *out, size_t size)
+{
+    size_t name_len = strlen(name);
+    for (const char *p = tag; p + name_len < tag_end; p++)
+    {
+        //Find attribute name on a word boundary
+        if (strncmp(p, name, name_len) || !isspace((unsigned char)p[-1]))
+            continue;
+        const char *v = p + name_len;
+        while (isspace((unsigned char)*v))
+            v++;
+        if (*v++ != '=')
+            continue;
+        while (isspace((unsigned char)*v))
+            v++;
+        if (*v++ != '"')
+            continue;
+
+        //Copy value
+        size_t len = 0;
+        while (v + len < tag_end && v[len] != '"')
+            len++;
+        if (v + len >= tag_end)
+            continue; //Unterminated value
+        if (len >= size)
+            len = size - 1;
+        memcpy(out, v, len);
+        out[len] = '\0';
+        return out;
+    }
+    return NULL;
+}
+
+static bool IO_FileExists(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return false;
+    fclose(fp);
+    return true;
+}
+
+static void IO_ResolveSource(char *out, const char *source)
+{
+    static const char source_dir[] = "${PROJECT_SOURCE_DIR}";
+
+    //Sources under the project dir come from the root
+    if (!strncmp(source, source_dir, sizeof(source_dir) - 1))
+    {
+        snprintf(out, IO_PATH_SIZE, "%s%s", pc_config.root, source + sizeof(source_dir) - 1);
+        return;
+    }
+
+    //Other sources are build outputs, fall back to the root for prebuilt files
+    snprintf(out, IO_PATH_SIZE, "%s/%s", pc_config.build, source);
+    if (!IO_FileExists(out))
+        snprintf(out, IO_PATH_SIZE, "%s/%s", pc_config.root, source);
+}
+
+static void IO_LoadLayout(void)
+{
+    char path[IO_PATH_SIZE];
+    snprintf(path, sizeof(path), "%s/funkin.xml", pc_config.root);
+
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+    {
+        sprintf(error_msg, "[IO_Init] Failed to open %s", path);
+        ErrorLock();
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    char *xml = malloc(size + 1);
+    if (xml == NULL || fread(xml, 1, size, fp) != (size_t)size)
+    {
+        sprintf(error_msg, "[IO_Init] Failed to read %s", path);
+        ErrorLock();
+    }
+    xml[size] = '\0';
+    fclose(fp);
+
+    //Walk tags, keeping track of the current directory
+    char dir[32] = "";
+    io_num_files = 0;
+
+    for (const char *p = strchr(xml, '<'); p != NULL; p = strchr(p + 1, '<'))
+    {
+        //Skip comments
+        if (!strncmp(p, "<!--", 4))
+        {
+            const char *end = strstr(p, "-->");
+            if (end == NULL)
+                break;
+            p = end;
+            continue;
+        }
+
+        const char *tag_end = strchr(p, '>');
+        if (tag_end == NULL)
+            break;
+
+        char name[32], source[IO_PATH_SIZE];
+        if (!strncmp(p, "<dir", 4) && isspace((unsigned char)p[4]))
+        {
+            if (IO_GetAttribute(p, tag_end, "name", name, sizeof(name)) != NULL)
+                strcpy(dir, name);
+        }
+        else if (!strncmp(p, "</dir", 5))
+        {
+            dir[0] = '\0';
+        }
+        else if (!strncmp(p, "<file", 5) && isspace((unsigned char)p[5]))
+        {
+            if (IO_GetAttribute(p, tag_end, "name", name, sizeof(name)) == NULL || IO_GetAttribute(p, tag_end, "source", source, sizeof(source)) == NULL)
+                continue;
+            if (io_num_files >= IO_MAX_FILES)
+            {
+                sprintf(error_msg, "[IO_Init] More than %d files in %s", IO_MAX_FILES, path);
+                ErrorLock();
+            }
+
+            IO_HostFile *file = &io_files[io_num_files++];
+            snprintf(file->cd_path, sizeof(file->cd_path), dir[0] ? "%s/%s" : "%s%s", dir, name);
+            for (char *c = file->cd_path; *c != '\0'; c++)
+                *c = tolower((unsigned char)*c);
+            IO_ResolveSource(file->host_path, source);
+        }
+        p = tag_end;
+    }
+
+    free(xml);
+    printf("[IO_Init] %u files in %s\n", io_num_files, path);
+}
+
+static IO_HostFile *IO_FindHostFile(const char *path)
+{
+    //Convert disc path to the layout's form
+    char cd_path[32];
+    size_t len = 0;
+    for (const char *c = (*path == '\\') ? (path + 1) : path; *c != '\0' && *c != ';' && len < sizeof(cd_path) - 1; c++)
+        cd_path[len++] = (*c == '\\') ? '/' : tolower((unsigned char)*c);
+    cd_path[len] = '\0';
+
+    //Search for file
+    for (uint32_t i = 0; i < io_num_files; i++)
+        if (!strcmp(io_files[i].cd_path, cd_path))
+            return &io_files[i];
+    return NULL;
+}
+
+//PC IO functions
+bool PC_FileExists(const char *path)
+{
+    IO_HostFile *host = IO_FindHostFile(path);
+    return host != NULL && IO_FileExists(host->host_path);
+}
+
+//IO functions
+void IO_Init(void)
+{
+    IO_LoadLayout();
+}
+
+void IO_Quit(void)
+{
+
+}
+
+void IO_FindFile(CdlFILE *file, const char *path)
+{
+    printf("[IO_FindFile] Searching for %s\n", path);
+
+    //Stop XA playback
+    Audio_StopStream();
+
+    //Search for file
+    IO_HostFile *host = IO_FindHostFile(path);
+    FILE *fp;
+    if (host != NULL && (fp = fopen(host->host_path, "rb")) != NULL)
+    {
+        fseek(fp, 0, SEEK_END);
+        file->size = ftell(fp);
+        fclose(fp);
+
+        file->host = host - io_files;
+        strncpy(file->name, host->cd_path, sizeof(file->name) - 1);
+        file->name[sizeof(file->name) - 1] = '\0';
+        return;
+    }
+
+    sprintf(error_msg, "[IO_FindFile] %s not found", path);
+    ErrorLock();
+}
+
+IO_Data IO_ReadFile(CdlFILE *file)
+{
+    //Reads complete immediately
+    return IO_AsyncReadFile(file);
+}
+
+IO_Data IO_AsyncReadFile(CdlFILE *file)
+{
+    //Stop XA playback
+    Audio_StopStream();
+
+    //Get number of sectors for the file
+    size_t sects = (file->size + IO_SECT_SIZE - 1) / IO_SECT_SIZE;
+
+    //Allocate a buffer for the file
+    size_t size;
+    IO_Data buffer = (IO_Data)calloc(1, size = (IO_SECT_SIZE * sects));
+    if (buffer == NULL)
+    {
+        sprintf(error_msg, "[IO_AsyncReadFile] Malloc (size %zX) fail", size);
+        ErrorLock();
+        return NULL;
+    }
+
+    //Read file
+    FILE *fp = fopen(io_files[file->host].host_path, "rb");
+    if (fp == NULL || fread(buffer, 1, file->size, fp) != file->size)
+    {
+        sprintf(error_msg, "[IO_AsyncReadFile] Failed to read %s", io_files[file->host].host_path);
+        ErrorLock();
+    }
+    fclose(fp);
+    return buffer;
+}
+
+IO_Data IO_Read(const char *path)
+{
+    printf("[IO_Read] Reading file %s\n", path);
+
+    //Search for file
+    CdlFILE file;
+    IO_FindFile(&file, path);
+
+    //Read file
+    return IO_ReadFile(&file);
+}
+
+IO_Data IO_AsyncRead(const char *path)
+{
+    printf("[IO_ReadAsync] Reading file %s\n", path);
+
+    //Search for file
+    CdlFILE file;
+    IO_FindFile(&file, path);
+
+    //Read file
+    return IO_AsyncReadFile(&file);
+}
+
+bool IO_IsSeeking(void)
+{
+    return false;
+}
+
+bool IO_IsReading(void)
+{
+    return false;
+}
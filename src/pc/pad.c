@@ -0,0 +1,56 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include "../pad.h"
+
+#include "pc.h"
+
+//Pad state
+static uint16_t pad_held[2];
+Pad pad_state, pad_state_2;
+
+//Internal pad functions
+static void Pad_UpdateState(Pad *this, uint16_t held)
+{
+    //Set pad state
+    this->press = held & (~this->held);
+    this->held = held;
+    this->left_x  = 0x80;
+    this->left_y  = 0x80;
+    this->right_x = 0x80;
+    this->right_y = 0x80;
+}
+
+//PC input functions
+void PC_SetPad(int i, uint16_t held)
+{
+    pad_held[i & 1] = held;
+}
+
+//Pad functions
+void Pad_Init(void)
+{
+    //Clear pad states
+    pad_state.held = pad_state.press = 0;
+    pad_state.left_x = pad_state.left_y = pad_state.right_x = pad_state.right_y = 0;
+
+    pad_state_2.held = pad_state_2.press = 0;
+    pad_state_2.left_x = pad_state_2.left_y = pad_state_2.right_x = pad_state_2.right_y = 0;
+
+    pad_held[0] = pad_held[1] = 0;
+}
+
+void Pad_Quit(void)
+{
+
+}
+
+void Pad_Update(void)
+{
+    //Read pad states
+    Pad_UpdateState(&pad_state,   pad_held[0]);
+    Pad_UpdateState(&pad_state_2, pad_held[1]);
+}
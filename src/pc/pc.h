@@ -0,0 +1,80 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef PSXF_GUARD_PC_H
+#define PSXF_GUARD_PC_H
+
+#include "../psx.h"
+#include "../timer.h"
+
+//PC backend configuration
+typedef struct
+{
+    const char *root;  //Directory containing funkin.xml and ${PROJECT_SOURCE_DIR} assets
+    const char *build; //Directory containing built assets (.cht, .tim, .arc, .vag...)
+    int fps;           //Virtual refresh rate driving the clock
+    uint32_t frames;   //Frames to run before PSX_Running() fails, 0 runs forever
+} PC_Config;
+
+extern PC_Config pc_config;
+
+//Recorded GPU primitives
+typedef enum
+{
+    PC_PrimType_Rect,  //POLY_F4
+    PC_PrimType_Quad,  //POLY_FT4
+    PC_PrimType_Sprt,  //SPRT
+    PC_PrimType_TPage, //DR_TPAGE
+    PC_PrimType_Text,  //FntSort
+    PC_PrimType_Max,
+} PC_PrimType;
+
+//Sizes of the primitives the PSX backend would have put in its buffer
+#define PC_PRIBUFF_SIZE     32768
+#define PC_SIZEOF_POLY_F4   24
+#define PC_SIZEOF_POLY_FT4  40
+#define PC_SIZEOF_SPRT      20
+#define PC_SIZEOF_SPRT_8    16
+#define PC_SIZEOF_DR_TPAGE  8
+
+typedef struct
+{
+    uint8_t type;
+    uint8_t semi; //Semi-transparency mode, 0xFF if opaque
+    uint8_t r, g, b;
+    uint16_t tpage, clut;
+    RECT src;
+    POINT p[4];
+} PC_Prim;
+
+typedef struct
+{
+    uint32_t frame;                       //Number of flips so far
+    uint32_t prims[PC_PrimType_Max];      //Primitives of each type in the last frame
+    size_t pribuff_used, pribuff_peak;    //PSX primitive buffer bytes in the last frame and peak
+    uint32_t pribuff_overflows;           //Frames that would have overflown the PSX primitive buffer
+} PC_GfxStats;
+
+extern PC_GfxStats pc_gfx_stats;
+
+const PC_Prim *PC_GetPrims(size_t *count);
+const char *PC_GetText(void);
+
+//Virtual clock
+void PC_StepClock(void);
+uint64_t PC_GetClock(void);
+
+//Host time
+uint64_t PC_GetHostNS(void);
+void PC_TakeProfileSections(uint64_t *ns); //ns[ProfileSection_Max], clears the accumulators
+
+//Input
+void PC_SetPad(int i, uint16_t held);
+
+//IO
+bool PC_FileExists(const char *path); //Disc path, like IO_FindFile
+
+#endif
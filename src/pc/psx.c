@@ -0,0 +1,67 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include "pc.h"
+
+#include <stdlib.h>
+
+//Arguments
+int my_argc;
+char **my_argv;
+
+//PC state
+PC_Config pc_config = {
+    ".",     //root
+    "build", //build
+    60,      //fps
+    0,       //frames
+};
+
+static uint32_t pc_frame;
+
+//PSX functions
+void PSX_Init(void)
+{
+    //Read options from the command line
+    for (int i = 1; i < my_argc; i++)
+    {
+        const char *arg = my_argv[i];
+        const char *val = (i + 1 < my_argc) ? my_argv[i + 1] : NULL;
+        if (val == NULL)
+        {
+            printf("[PSX_Init] Ignoring %s without a value\n", arg);
+            break;
+        }
+
+        if (!strcmp(arg, "-root"))
+            pc_config.root = val;
+        else if (!strcmp(arg, "-build"))
+            pc_config.build = val;
+        else if (!strcmp(arg, "-fps"))
+            pc_config.fps = atoi(val);
+        else if (!strcmp(arg, "-frames"))
+            pc_config.frames = strtoul(val, NULL, 0);
+        else
+            continue;
+        i++;
+    }
+
+    if (pc_config.fps <= 0)
+        pc_config.fps = 60;
+    pc_frame = 0;
+}
+
+void PSX_Quit(void)
+{
+
+}
+
+bool PSX_Running(void)
+{
+    if (pc_config.frames == 0)
+        return true;
+    return pc_frame++ < pc_config.frames;
+}
@@ -0,0 +1,484 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+//funkinsim - plays songs headlessly at a fixed frame rate and reports how long Stage_Tick takes
+
+#include "pc.h"
+
+#include <stdlib.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include "../main.h"
+#include "../timer.h"
+#include "../io.h"
+#include "../gfx.h"
+#include "../audio.h"
+#include "../pad.h"
+#include "../random.h"
+#include "../trans.h"
+#include "../stage.h"
+#include "../save.h"
+
+//Game loop
+GameLoop gameloop;
+SCREEN screen;
+
+//Error handler
+char error_msg[0x200];
+
+//Set while a chart loads, so a missing file skips the chart instead of ending the run
+static jmp_buf *sim_load_error;
+
+void ErrorLock(void)
+{
+    if (sim_load_error != NULL)
+        longjmp(*sim_load_error, 1);
+    fprintf(stderr, "A fatal error has occured:\n\n%s\n", error_msg);
+    exit(1);
+}
+
+//Simulator options
+#define SIM_MAX_FRAMES (60 * 60 * 20) //20 minutes at 60fps
+#define SIM_MAX_INPUTS 0x10000
+
+typedef struct
+{
+    uint32_t frame;
+    uint16_t held;
+} SimInput;
+
+static struct
+{
+    int song; //StageId, -1 for every song
+    int diff; //StageDiff, -1 for every difficulty
+    int repeat;
+    bool csv, verbose;
+
+    //Scripted input, botplay if there is none
+    SimInput *inputs;
+    size_t num_inputs;
+} sim = {-1, -1, 1, false, false, NULL, 0};
+
+//The game logs to stdout, results are written here instead
+static FILE *sim_out;
+
+//Measured cost of a single frame
+typedef enum
+{
+    SimCost_Tick,
+    SimCost_ProcessPlayer,
+    SimCost_DrawNotes,
+    SimCost_ObjectList,
+    SimCost_Max,
+} SimCost;
+
+static const char *sim_cost_names[SimCost_Max] = {
+    "Stage_Tick",
+    "Stage_ProcessPlayer",
+    "Stage_DrawNotes",
+    "ObjectList_Tick",
+};
+
+typedef struct
+{
+    uint64_t cost[SimCost_Max];
+} SimFrame;
+
+static SimFrame sim_frames[SIM_MAX_FRAMES];
+
+typedef struct
+{
+    uint32_t frames, notes, misses;
+    int32_t score;
+    bool died;
+    size_t pribuff_peak;
+    uint32_t pribuff_overflows;
+} SimResult;
+
+//Stage info
+static const struct
+{
+    uint8_t week, week_song;
+    const char *name;
+} sim_songs[StageId_Max] = {
+    {1, 1, "Bopeebo"},
+    {1, 2, "Fresh"},
+    {1, 3, "Dadbattle"},
+    {1, 4, "Tutorial"},
+    {2, 1, "Spookeez"},
+    {2, 2, "South"},
+    {2, 3, "Monster"},
+    {3, 1, "Pico"},
+    {3, 2, "Philly"},
+    {3, 3, "Blammed"},
+    {4, 1, "Satin Panties"},
+    {4, 2, "High"},
+    {4, 3, "MILF"},
+    {4, 4, "Test"},
+    {5, 1, "Cocoa"},
+    {5, 2, "Eggnog"},
+    {5, 3, "Winter Horrorland"},
+    {6, 1, "Senpai"},
+    {6, 2, "Roses"},
+    {6, 3, "Thorns"},
+    {7, 1, "Ugh"},
+    {7, 2, "Guns"},
+    {7, 3, "Stress"},
+};
+
+//Simulator functions
+static void Sim_Usage(const char *argv0)
+{
+    printf("usage: %s [-root dir] [-build dir] [-fps n] [-song id|all] [-diff easy|normal|hard|all] [-input file] [-repeat n] [-csv] [-verbose]\n", argv0);
+    printf("  -song    StageId to play (0 = Bopeebo), every song with a chart by default\n");
+    printf("  -diff    difficulty to play, all of them by default\n");
+    printf("  -input   scripted input, one \"<frame> <held pad bits in hex>\" per line, botplay if omitted\n");
+    printf("  -repeat  play each chart n times and keep the fastest time of every frame\n");
+    printf("  -csv     print per-frame costs of every chart as csv instead of a summary\n");
+    printf("  -verbose keep the game's own logging\n");
+}
+
+static void Sim_LoadInput(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        sprintf(error_msg, "[Sim_LoadInput] Failed to open %s", path);
+        ErrorLock();
+    }
+
+    sim.inputs = malloc(sizeof(SimInput) * SIM_MAX_INPUTS);
+    sim.num_inputs = 0;
+
+    char line[128];
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        unsigned frame, held;
+        if (line[0] == '#' || sscanf(line, "%u %x", &frame, &held) != 2)
+            continue;
+        if (sim.num_inputs >= SIM_MAX_INPUTS)
+        {
+            sprintf(error_msg, "[Sim_LoadInput] More than %d inputs in %s", SIM_MAX_INPUTS, path);
+            ErrorLock();
+        }
+        if (sim.num_inputs != 0 && frame < sim.inputs[sim.num_inputs - 1].frame)
+        {
+            sprintf(error_msg, "[Sim_LoadInput] Inputs in %s are not sorted by frame", path);
+            ErrorLock();
+        }
+        sim.inputs[sim.num_inputs].frame = frame;
+        sim.inputs[sim.num_inputs].held = held;
+        sim.num_inputs++;
+    }
+    fclose(fp);
+}
+
+static void Sim_ParseArgs(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const char *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (!strcmp(arg, "-csv"))
+        {
+            sim.csv = true;
+            continue;
+        }
+        if (!strcmp(arg, "-verbose"))
+        {
+            sim.verbose = true;
+            continue;
+        }
+        if (!strcmp(arg, "-h") || !strcmp(arg, "-help") || !strcmp(arg, "--help"))
+        {
+            Sim_Usage(argv[0]);
+            exit(0);
+        }
+        if (val == NULL)
+            break;
+
+        if (!strcmp(arg, "-song"))
+        {
+            sim.song = strcmp(val, "all") ? atoi(val) : -1;
+            if (sim.song >= StageId_Max)
+            {
+                printf("song %d out of range (0-%d)\n", sim.song, StageId_Max - 1);
+                exit(1);
+            }
+        }
+        else if (!strcmp(arg, "-diff"))
+        {
+            if (!strcmp(val, "easy"))
+                sim.diff = StageDiff_Easy;
+            else if (!strcmp(val, "normal"))
+                sim.diff = StageDiff_Normal;
+            else if (!strcmp(val, "hard"))
+                sim.diff = StageDiff_Hard;
+            else
+                sim.diff = -1;
+        }
+        else if (!strcmp(arg, "-input"))
+        {
+            Sim_LoadInput(val);
+        }
+        else if (!strcmp(arg, "-repeat"))
+        {
+            if ((sim.repeat = atoi(val)) < 1)
+                sim.repeat = 1;
+        }
+        else
+        {
+            //Left for PSX_Init
+            continue;
+        }
+        i++;
+    }
+}
+
+static bool Sim_HasChart(StageId id, StageDiff diff)
+{
+    char chart_path[64];
+    sprintf(chart_path, "\\WEEK%d\\%d.%d%c.CHT;1", sim_songs[id].week, sim_songs[id].week, sim_songs[id].week_song, "ENH"[diff]);
+    return PC_FileExists(chart_path);
+}
+
+static bool Sim_SongEnded(void)
+{
+    //Same condition Stage_Tick uses to leave the song
+    return stage.note_scroll >= 0 && !Audio_IsPlaying();
+}
+
+static bool Sim_Load(StageId id, StageDiff diff)
+{
+    jmp_buf env;
+    if (setjmp(env))
+    {
+        //Free whatever got loaded before the error
+        sim_load_error = NULL;
+        Stage_Unload();
+        return false;
+    }
+
+    sim_load_error = &env;
+    Stage_Load(id, diff, false);
+    sim_load_error = NULL;
+    return true;
+}
+
+//Returns 0 if the chart failed to load
+static uint32_t Sim_Play(StageId id, StageDiff diff, uint32_t known_frames, SimResult *result)
+{
+    //Start from the same state every run
+    RandomSeed(0);
+    Trans_Clear();
+    Pad_Init();
+    PC_SetPad(0, 0);
+
+    if (!Sim_Load(id, diff))
+        return 0;
+    gameloop = GameLoop_Stage;
+    Timer_Reset();
+
+    memset(result, 0, sizeof(*result));
+    for (Note *note = stage.notes; note->pos != 0xFFFF; note++)
+        if (!(note->type & (NOTE_FLAG_OPPONENT | NOTE_FLAG_MINE)))
+            result->notes++;
+
+    size_t input = 0;
+    uint32_t pribuff_overflows = pc_gfx_stats.pribuff_overflows;
+    uint32_t frame;
+    for (frame = 0; frame < SIM_MAX_FRAMES; frame++)
+    {
+        //Feed scripted input
+        while (input < sim.num_inputs && sim.inputs[input].frame <= frame)
+            PC_SetPad(0, sim.inputs[input++].held);
+
+        //Tick stage
+        uint64_t sections[ProfileSection_Max];
+        PC_TakeProfileSections(sections);
+
+        uint64_t start = PC_GetHostNS();
+        Timer_CalcDT();
+        Pad_Update();
+        Stage_Tick();
+        uint64_t tick = PC_GetHostNS() - start;
+
+        PC_TakeProfileSections(sections);
+        Gfx_Flip();
+
+        //Keep the fastest time seen for this frame
+        SimFrame measured = {{
+            tick,
+            sections[ProfileSection_ProcessPlayer],
+            sections[ProfileSection_DrawNotes],
+            sections[ProfileSection_ObjectList],
+        }};
+        for (int i = 0; i < SimCost_Max; i++)
+            if (frame >= known_frames || measured.cost[i] < sim_frames[frame].cost[i])
+                sim_frames[frame].cost[i] = measured.cost[i];
+
+        if (pc_gfx_stats.pribuff_used > result->pribuff_peak)
+            result->pribuff_peak = pc_gfx_stats.pribuff_used;
+
+        if (stage.state != StageState_Play)
+        {
+            result->died = true;
+            frame++;
+            break;
+        }
+        if (Sim_SongEnded())
+        {
+            frame++;
+            break;
+        }
+    }
+
+    result->frames = frame;
+    result->score = stage.player_state[0].score * 10;
+    result->misses = stage.player_state[0].miss;
+    result->pribuff_overflows = pc_gfx_stats.pribuff_overflows - pribuff_overflows;
+
+    Stage_Unload();
+    return frame;
+}
+
+static const char *sim_diff_names[] = {"easy", "normal", "hard"};
+
+static void Sim_Report(StageId id, StageDiff diff, const SimResult *result)
+{
+    if (sim.csv)
+    {
+        fprintf(sim_out, "frame");
+        for (int i = 0; i < SimCost_Max; i++)
+            fprintf(sim_out, ",%s_us", sim_cost_names[i]);
+        fprintf(sim_out, "\n");
+        for (uint32_t f = 0; f < result->frames; f++)
+        {
+            fprintf(sim_out, "%u", f);
+            for (int i = 0; i < SimCost_Max; i++)
+                fprintf(sim_out, ",%.3f", sim_frames[f].cost[i] / 1000.0);
+            fprintf(sim_out, "\n");
+        }
+        fflush(sim_out);
+        return;
+    }
+
+    fprintf(sim_out, "%d.%d %s (%s): %u frames, %u notes, score %d, %d misses%s\n",
+        sim_songs[id].week, sim_songs[id].week_song, sim_songs[id].name, sim_diff_names[diff],
+        result->frames, result->notes, result->score, result->misses, result->died ? ", died" : "");
+
+    for (int i = 0; i < SimCost_Max; i++)
+    {
+        uint64_t worst = 0, total = 0;
+        uint32_t worst_frame = 0;
+        for (uint32_t f = 0; f < result->frames; f++)
+        {
+            total += sim_frames[f].cost[i];
+            if (sim_frames[f].cost[i] > worst)
+            {
+                worst = sim_frames[f].cost[i];
+                worst_frame = f;
+            }
+        }
+        fprintf(sim_out, "  %-20s worst %9.3fus (frame %6u)  mean %9.3fus\n",
+            sim_cost_names[i], worst / 1000.0, worst_frame,
+            result->frames ? (total / (double)result->frames) / 1000.0 : 0.0);
+    }
+    fprintf(sim_out, "  %-20s peak %zu/%d bytes, %u overflowing frames\n", "pribuff", result->pribuff_peak, PC_PRIBUFF_SIZE, result->pribuff_overflows);
+
+    //Keep finished reports if a later chart crashes
+    fflush(sim_out);
+}
+
+//Entry point
+int main(int argc, char **argv)
+{
+    //Remember arguments
+    my_argc = argc;
+    my_argv = argv;
+    Sim_ParseArgs(argc, argv);
+
+    //Silence the game unless asked not to
+    sim_out = stdout;
+    if (!sim.verbose)
+    {
+        sim_out = fdopen(dup(STDOUT_FILENO), "w");
+        if (sim_out == NULL || freopen("/dev/null", "w", stdout) == NULL)
+        {
+            fprintf(stderr, "[funkinsim] Failed to redirect stdout\n");
+            return 1;
+        }
+    }
+
+    //Initialize system
+    PSX_Init();
+    Gfx_Init();
+    Pad_Init();
+    IO_Init();
+    Audio_Init();
+    Timer_Init();
+
+    //Don't let a save file change the results
+    defaultSettings();
+    stage.prefs.botplay = (sim.num_inputs == 0);
+    stage.mode = StageMode_Normal;
+
+    Gfx_ScreenSetup();
+
+    //Play every requested chart
+    int played = 0, failed = 0;
+    for (int id = 0; id < StageId_Max; id++)
+    {
+        if (sim.song >= 0 && id != sim.song)
+            continue;
+        for (int diff = StageDiff_Easy; diff <= StageDiff_Hard; diff++)
+        {
+            if (sim.diff >= 0 && diff != sim.diff)
+                continue;
+            if (!Sim_HasChart(id, diff))
+                continue;
+
+            SimResult result;
+            uint32_t frames = 0;
+            for (int run = 0; run < sim.repeat; run++)
+            {
+                uint32_t run_frames = Sim_Play(id, diff, frames, &result);
+                if (run_frames == 0)
+                    break;
+                if (run != 0 && run_frames != frames)
+                    fprintf(sim_out, "[funkinsim] Warning: run %d took %u frames instead of %u, the simulation isn't deterministic\n", run, run_frames, frames);
+                if (run_frames > frames)
+                    frames = run_frames;
+            }
+            if (frames == 0)
+            {
+                fprintf(sim_out, "%d.%d %s (%s): failed to load, %s\n",
+                    sim_songs[id].week, sim_songs[id].week_song, sim_songs[id].name, sim_diff_names[diff], error_msg);
+                fflush(sim_out);
+                failed++;
+                continue;
+            }
+            Sim_Report(id, diff, &result);
+            played++;
+        }
+    }
+
+    if (played == 0 && failed == 0)
+    {
+        fprintf(sim_out, "[funkinsim] No charts found\n");
+        return 1;
+    }
+
+    //Deinitialize system
+    Pad_Quit();
+    Gfx_Quit();
+    IO_Quit();
+    PSX_Quit();
+
+    fflush(sim_out);
+    return (failed != 0) ? 1 : 0;
+}
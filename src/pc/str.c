@@ -0,0 +1,60 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include "../str.h"
+
+#include "../io.h"
+#include "../main.h"
+#include "../gfx.h"
+
+//There is no MDEC on PC, movies are looked up and then skipped
+static GameLoop lastloop;
+
+void STR_Init(void)
+{
+
+}
+
+void STR_InitStream(void)
+{
+
+}
+
+void STR_StartStream(const char* path)
+{
+    lastloop = gameloop;
+    gameloop = GameLoop_Movie;
+    STR_InitStream();
+
+    //Make sure the movie exists
+    CdlFILE file;
+    IO_FindFile(&file, path);
+    stage.str_playing = true;
+}
+
+void STR_StopStream(void)
+{
+    stage.str_playing = false;
+    gameloop = lastloop;
+}
+
+void STR_Proccess(void)
+{
+    Gfx_Flip();
+    STR_StopStream();
+}
+
+void STR_SetDataBuffer(void *buffer, size_t size)
+{
+    (void)buffer;
+    (void)size;
+}
+
+size_t STR_GetDataSize(void)
+{
+    //Skipped movies don't carry any data, callers fall back to reading the files
+    return 0;
+}
@@ -0,0 +1,96 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include "../timer.h"
+
+#include <time.h>
+#include "pc.h"
+
+//Virtual clock, advanced once per flip so runs are deterministic
+static uint64_t clock_frames;
+
+void PC_StepClock(void)
+{
+    clock_frames++;
+}
+
+uint64_t PC_GetClock(void)
+{
+    return clock_frames * TICKS_PER_SEC / pc_config.fps;
+}
+
+//Profiling uses real host time
+static uint64_t profile_start, total_time;
+
+static uint64_t Timer_HostNS(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void Timer_StartProfile(void)
+{
+    uint64_t now = Timer_HostNS();
+    total_time = now - profile_start;
+    profile_start = now;
+}
+
+// returns cpu usage percentage of the last frame
+int Timer_EndProfile(void)
+{
+    uint64_t cpu_time = Timer_HostNS() - profile_start;
+    return 100 * cpu_time / (total_time + 1);
+}
+
+//Section profiling, accumulated until read by PC_TakeProfileSections
+static uint64_t section_start[ProfileSection_Max], section_ns[ProfileSection_Max];
+
+void Timer_StartProfileSection(ProfileSection section)
+{
+    section_start[section] = Timer_HostNS();
+}
+
+void Timer_EndProfileSection(ProfileSection section)
+{
+    section_ns[section] += Timer_HostNS() - section_start[section];
+}
+
+void PC_TakeProfileSections(uint64_t *ns)
+{
+    for (int i = 0; i < ProfileSection_Max; i++)
+    {
+        ns[i] = section_ns[i];
+        section_ns[i] = 0;
+    }
+}
+
+uint64_t PC_GetHostNS(void)
+{
+    return Timer_HostNS();
+}
+
+void Timer_Init(void)
+{
+    clock_frames = 0;
+    timer.timer_irq_count = 0;
+}
+
+uint64_t Timer_GetTime(void)
+{
+    return PC_GetClock();
+}
+
+uint32_t Timer_GetTimeint32(void)
+{
+    return (uint32_t)PC_GetClock();
+}
+
+void Timer_ResetCounter(void)
+{
+    clock_frames = 0;
+    timer.timer_irq_count = 0;
+}
@@ -14,11 +14,13 @@ extern char **my_argv;
 #include <sys/types.h>
 #include <stdio.h>
 
-#include <psxetc.h>
-#include <psxgpu.h>
-#include <psxspu.h>
-#include <psxcd.h>
-#include <psxapi.h>
+#ifndef PSXF_PC
+    #include <psxetc.h>
+    #include <psxgpu.h>
+    #include <psxspu.h>
+    #include <psxcd.h>
+    #include <psxapi.h>
+#endif
 
 #include <stddef.h>
 #include <string.h>
@@ -27,6 +29,46 @@ extern char **my_argv;
 #include <stdint.h>
 #include <stdbool.h>
 
+#ifdef PSXF_PC
+    //Stand-ins for the PSn00bSDK types used outside of the platform backend
+    #define F_CPU 33868800
+
+    typedef struct
+    {
+        int16_t x, y, w, h;
+    } RECT;
+
+    typedef struct
+    {
+        RECT disp, screen;
+        uint8_t isinter, isrgb24, reverse;
+    } DISPENV;
+
+    typedef struct
+    {
+        RECT clip;
+        int16_t ofs[2];
+        uint8_t isbg, r0, g0, b0;
+    } DRAWENV;
+
+    typedef struct
+    {
+        uint8_t minute, second, sector, track;
+    } CdlLOC;
+
+    typedef struct
+    {
+        CdlLOC pos;
+        uint32_t size;
+        char name[16];
+        uint32_t host; //Index of the host file backing this one
+    } CdlFILE;
+
+    //Debug text is recorded by the PC gfx backend
+    int PC_FntPrint(int id, const char *fmt, ...);
+    #define FntPrint PC_FntPrint
+#endif
+
 //Misc. functions
 #define MsgPrint FntPrint
 
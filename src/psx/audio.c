@@ -70,6 +70,8 @@
 #include <hwregs_c.h>
 
 #include "stream.h"
+#include "../audio.h"
+#include "../vag.h"
 #include "../io.h"
 
 #include "../timer.h"
@@ -83,26 +85,6 @@ int buffers_size = 0;
 // order to prevent underruns and glitches in the audio output.
 #define REFILL_THRESHOLD 24
 
-/* .VAG header structure */
-
-typedef struct {
-    uint32_t magic;         // 0x69474156 ("VAGi") for interleaved files
-    uint32_t version;
-    uint32_t interleave;    // Little-endian, size of each channel buffer
-    uint32_t size;          // Big-endian, in bytes
-    uint32_t sample_rate;   // Big-endian, in Hertz
-    uint16_t _reserved[5];
-    uint16_t channels;      // Little-endian, channel count (stereo if 0)
-    char     name[16];
-} VAG_Header;
-
-#define SWAP_ENDIAN(x) ( \
-    (((uint32_t) (x) & 0x000000ff) << 24) | \
-    (((uint32_t) (x) & 0x0000ff00) <<  8) | \
-    (((uint32_t) (x) & 0x00ff0000) >>  8) | \
-    (((uint32_t) (x) & 0xff000000) >> 24) \
-)
-
 /* Interrupt callbacks */
 
 #define DUMMY_BLOCK_ADDR   0x1000
@@ -119,6 +101,23 @@ typedef struct {
 static Stream_Context    stream_ctx;
 static StreamReadContext read_ctx;
 
+// Volume scale of each stream channel in 4.12 fixed point, from the .VAG's
+// gain table. funkinvagpak uses it to level out the loudness of all songs
+// without having to re-encode them.
+static uint16_t stream_gain[24];
+
+// Role and pan of each stream channel, from the .VAG's role table (files
+// without one are assumed to hold stereo pairs with the vocals on channel 2).
+static uint8_t stream_role[24];
+static int     stream_channels = 0;
+
+static void Audio_SetStreamVolume(int ch, uint16_t vol) {
+    int pan = stream_role[ch] >> 4;
+
+    SPU_CH_VOL_L(ch) = (pan != VAG_PAN_RIGHT) ? ((vol * stream_gain[ch]) >> 12) : 0x0000;
+    SPU_CH_VOL_R(ch) = (pan != VAG_PAN_LEFT)  ? ((vol * stream_gain[ch]) >> 12) : 0x0000;
+}
+
 void cd_read_handler(CdlIntrResult event, uint8_t *payload) {
     // Mark the data as valid.
     if (event != CdlDiskError)
@@ -152,6 +151,9 @@ void Audio_Init(void) {
     SpuInit();
     Audio_ResetChannels();
     Audio_ClearAlloc();
+
+    for (int i = 0; i < 24; i++)
+        stream_gain[i] = 0x1000;
 }
 
 bool Audio_FeedStream(void) {
@@ -223,22 +225,54 @@ void Audio_LoadStream(const char *path, bool loop) {
     int num_chunks   =
         (SWAP_ENDIAN(vag->size) + vag->interleave - 1) / vag->interleave;
 
+    if (num_channels > 24) {
+        sprintf(error_msg, "[Audio_LoadStream] %s has too many channels (%d)", path, num_channels);
+        ErrorLock();
+    }
+
+    for (int ch = 0; ch < 24; ch++)
+        stream_gain[ch] = (ch < num_channels && (vag->flags & VAG_FLAG_GAIN)) ? vag->gain[ch] : 0x1000;
+
+    for (int ch = 0; ch < 24; ch++) {
+        if (vag->flags & VAG_FLAG_ROLE)
+            stream_role[ch] = vag->role[ch];
+        else if (ch == 2)
+            stream_role[ch] = AudioRole_Vocal | (VAG_PAN_CENTER << 4);
+        else
+            stream_role[ch] = AudioRole_Inst | ((ch % 2) << 4);
+    }
+    stream_channels = num_channels;
+
     __builtin_memset(&config, 0, sizeof(Stream_Config));
 
     config.spu_address = STREAM_BUFFER_ADDR;
     config.interleave  = vag->interleave;
-    config.buffer_size = RAM_BUFFER_SIZE;
     config.sample_rate = SWAP_ENDIAN(vag->sample_rate);
     config.timer_function    = &Timer_GetTimeint32;
     config.timer_rate        = TICKS_PER_SEC;
 
-    // Use the first N channels of the SPU and pan them left/right in pairs
-    // (this assumes the stream contains one or more stereo tracks).
+    // Use the first N channels of the SPU and pan them as the role table says.
+    // Channels encoded at a lower sample rate take up less space in each chunk.
+    size_t chunk_size = 0;
+
     for (int ch = 0; ch < num_channels; ch++) {
         config.channel_mask = (config.channel_mask << 1) | 1;
+        config.pitch[ch]    = (vag->flags & VAG_FLAG_PITCH) ? vag->pitch[ch] : 0x1000;
+        chunk_size         += (config.interleave * config.pitch[ch]) >> 12;
 
-        SPU_CH_VOL_L(ch) = (ch % 2) ? 0x0000 : 0x3fff;
-        SPU_CH_VOL_R(ch) = (ch % 2) ? 0x3fff : 0x0000;
+        Audio_SetStreamVolume(ch, 0x3fff);
+    }
+
+    // The ring buffer must hold a whole number of chunks (which are pulled out
+    // of it in one piece) as well as of sectors (which are read into it).
+    size_t buffer_unit = chunk_size;
+    while (buffer_unit % 2048)
+        buffer_unit += chunk_size;
+
+    config.buffer_size = RAM_BUFFER_SIZE - (RAM_BUFFER_SIZE % buffer_unit);
+    if (!config.buffer_size) {
+        sprintf(error_msg, "[Audio_LoadStream] chunks of %s too large (%d bytes)", path, (int)buffer_unit);
+        ErrorLock();
     }
 
     Stream_Init(&stream_ctx, &config);
@@ -247,7 +281,7 @@ void Audio_LoadStream(const char *path, bool loop) {
 
     read_ctx.start_lba     = CdPosToInt(&file.pos) + 1;
     read_ctx.stream_length =
-        (num_channels * num_chunks * vag->interleave + 2047) / 2048;
+        (num_chunks * stream_ctx.chunk_size + 2047) / 2048;
     read_ctx.sample_rate   = config.sample_rate;
     read_ctx.next_sector   = 0;
     read_ctx.refill_length = 0;
@@ -289,9 +323,19 @@ uint32_t Audio_GetInitialTime(void) {
     else return 0;
 }
 
+// Volumes of stream channels are scaled by the stream's gain table.
 void Audio_SetVolume(uint8_t i, uint16_t vol_left, uint16_t vol_right) {
-    SPU_CH_VOL_L(i) = vol_left;
-    SPU_CH_VOL_R(i) = vol_right;
+    SPU_CH_VOL_L(i) = (vol_left  * stream_gain[i]) >> 12;
+    SPU_CH_VOL_R(i) = (vol_right * stream_gain[i]) >> 12;
+}
+
+// Sets the volume of every stream channel with one of the given roles, keeping
+// its pan.
+void Audio_SetRoleVolume(uint32_t role_mask, uint16_t vol) {
+    for (int ch = 0; ch < stream_channels; ch++) {
+        if (role_mask & AUDIO_ROLE_MASK(stream_role[ch] & 0xf))
+            Audio_SetStreamVolume(ch, vol);
+    }
 }
 
 //vag sillies
@@ -299,10 +343,19 @@ void Audio_SetVolume(uint8_t i, uint16_t vol_left, uint16_t vol_right) {
 
 static uint8_t lastChannelUsed = 0;
 
+// Sound effects rotate over the SPU channels the stream isn't using, so songs
+// with more stems leave fewer of them rather than being cut off.
 static uint8_t getFreeChannel(void) {
+    if (stream_channels >= 24) {
+        sprintf(error_msg, "[Audio_PlaySound] no free channels, stream uses all %d", stream_channels);
+        ErrorLock();
+    }
+
     uint8_t channel = lastChannelUsed;
-    lastChannelUsed = (channel + 1) % 20;
-    return channel + 4;
+    if (channel < stream_channels || channel >= 24)
+        channel = stream_channels;
+    lastChannelUsed = channel + 1;
+    return channel;
 }
 
 void Audio_PlaySound(uint32_t addr, int volume) {
@@ -268,11 +268,6 @@ void Gfx_BlitTexCol(Gfx_Tex *tex, const RECT *src, int32_t x, int32_t y, uint8_t
     nextpri += sizeof(DR_TPAGE);
 }
 
-void Gfx_BlitTex(Gfx_Tex *tex, const RECT *src, int32_t x, int32_t y)
-{
-    Gfx_BlitTexCol(tex, src, x, y, 0x80, 0x80, 0x80);
-}
-
 void Gfx_DrawTexCol(Gfx_Tex *tex, const RECT *src, const RECT *dst, uint8_t r, uint8_t g, uint8_t b)
 {
     //Manipulate rects to comply with GPU restrictions
@@ -309,11 +304,6 @@ void Gfx_DrawTexCol(Gfx_Tex *tex, const RECT *src, const RECT *dst, uint8_t r, u
     nextpri += sizeof(POLY_FT4);
 }
 
-void Gfx_DrawTex(Gfx_Tex *tex, const RECT *src, const RECT *dst)
-{
-    Gfx_DrawTexCol(tex, src, dst, 0x80, 0x80, 0x80);
-}
-
 void Gfx_DrawTexArbCol(Gfx_Tex *tex, const RECT *src, const POINT *p0, const POINT *p1, const POINT *p2, const POINT *p3, uint8_t r, uint8_t g, uint8_t b)
 {
     //Add quad
@@ -329,91 +319,6 @@ void Gfx_DrawTexArbCol(Gfx_Tex *tex, const RECT *src, const POINT *p0, const POI
     nextpri += sizeof(POLY_FT4);
 }
 
-void Gfx_DrawTexArb(Gfx_Tex *tex, const RECT *src, const POINT *p0, const POINT *p1, const POINT *p2, const POINT *p3)
-{
-    Gfx_DrawTexArbCol(tex, src, p0, p1, p2, p3, 0x80, 0x80, 0x80);
-}
-
-void Gfx_DrawTexRotate(Gfx_Tex *tex, const RECT *src, const RECT *dst, uint8_t angle)
-{   
-    int16_t sin = MUtil_Sin(angle);
-    int16_t cos = MUtil_Cos(angle);
-    int pw = dst->w / 2;
-    int ph = dst->h / 2;
-
-    //Get tank rotated points
-    POINT p0 = {-pw, -ph};
-    MUtil_RotatePoint(&p0, sin, cos);
-    
-    POINT p1 = { pw, -ph};
-    MUtil_RotatePoint(&p1, sin, cos);
-    
-    POINT p2 = {-pw,  ph};
-    MUtil_RotatePoint(&p2, sin, cos);
-    
-    POINT p3 = { pw,  ph};
-    MUtil_RotatePoint(&p3, sin, cos);
-    
-    POINT d0 = {
-        dst->x + p0.x,
-        dst->y + p0.y
-    };
-    POINT d1 = {
-        dst->x + p1.x,
-        dst->y + p1.y
-    };
-    POINT d2 = {
-        dst->x + p2.x,
-        dst->y + p2.y
-    };
-    POINT d3 = {
-        dst->x + p3.x,
-        dst->y + p3.y
-    };
-    
-    Gfx_DrawTexArb(tex, src, &d0, &d1, &d2, &d3);
-}
-
-void Gfx_BlendTexRotate(Gfx_Tex *tex, const RECT *src, const RECT *dst, uint8_t angle, uint8_t mode)
-{   
-    int16_t sin = MUtil_Sin(angle);
-    int16_t cos = MUtil_Cos(angle);
-    int pw = dst->w / 2;
-    int ph = dst->h / 2;
-
-    //Get tank rotated points
-    POINT p0 = {-pw, -ph};
-    MUtil_RotatePoint(&p0, sin, cos);
-    
-    POINT p1 = { pw, -ph};
-    MUtil_RotatePoint(&p1, sin, cos);
-    
-    POINT p2 = {-pw,  ph};
-    MUtil_RotatePoint(&p2, sin, cos);
-    
-    POINT p3 = { pw,  ph};
-    MUtil_RotatePoint(&p3, sin, cos);
-    
-    POINT d0 = {
-        dst->x + p0.x,
-        dst->y + p0.y
-    };
-    POINT d1 = {
-        dst->x + p1.x,
-        dst->y + p1.y
-    };
-    POINT d2 = {
-        dst->x + p2.x,
-        dst->y + p2.y
-    };
-    POINT d3 = {
-        dst->x + p3.x,
-        dst->y + p3.y
-    };
-    
-    Gfx_BlendTexArb(tex, src, &d0, &d1, &d2, &d3, mode);
-}
-
 void Gfx_BlendTexArb(Gfx_Tex *tex, const RECT *src, const POINT *p0, const POINT *p1, const POINT *p2, const POINT *p3, uint8_t mode)
 {
     //Add quad
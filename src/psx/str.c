@@ -37,13 +37,17 @@
 
 #define VRAM_X_COORD(x) ((x) * BLOCK_SIZE / 16)
 
+// Largest number of data sectors that can be tracked, which is already more
+// than the PS1's 2 MB of RAM could hold.
+#define DATA_MAX_SECTORS 1024
+
 // All non-audio sectors in .STR files begin with this 32-byte header, which
 // contains metadata about the sector and is followed by a chunk of frame
 // bitstream data.
 // https://problemkaputt.de/psx-spx.htm#cdromfilevideostrstreamingandbspicturecompressionsony
 typedef struct {
     uint16_t magic;         // Always 0x0160
-    uint16_t type;          // 0x8001 for MDEC
+    uint16_t type;          // 0x8001 for MDEC, 0x8002 for data
     uint16_t sector_id;     // Chunk number (0 = first chunk of this frame)
     uint16_t sector_count;  // Total number of chunks for this frame
     uint32_t frame_id;      // Frame number
@@ -71,6 +75,15 @@ typedef struct {
 
     volatile int8_t sector_pending, frame_ready;
     volatile int8_t cur_frame, cur_slice;
+
+    // Data sectors (chunk type 0x8002, see psxavenc -d/-D) are collected in
+    // here while the video plays. The file is sent over and over, so the
+    // bitmap keeps track of which chunks have been read at least once.
+    uint8_t *data;
+    size_t   data_size;
+    volatile size_t data_length;
+    volatile int    data_sectors_read, data_sector_count;
+    uint32_t data_read_map[DATA_MAX_SECTORS / 32];
 } StreamContext;
 
 static GameLoop lastloop;
@@ -82,6 +95,37 @@ static StreamContext str_ctx;
 // limited).
 static STR_Header sector_header;
 
+static void clear_data_sectors(void) {
+    str_ctx.data_length       = 0;
+    str_ctx.data_sectors_read = 0;
+    str_ctx.data_sector_count = 0;
+    memset(str_ctx.data_read_map, 0, sizeof(str_ctx.data_read_map));
+}
+
+void cd_data_handler(void) {
+    // Spare data sectors have a chunk count of 0. The last chunk is still a
+    // whole sector, so it has to fit in the buffer as well.
+    int    id     = sector_header.sector_id;
+    size_t offset = 2016 * id;
+    if (!str_ctx.data || id >= sector_header.sector_count || id >= DATA_MAX_SECTORS)
+        return;
+    if (offset + 2016 > str_ctx.data_size)
+        return;
+
+    // Skip chunks that have already been read, so the data isn't rewritten
+    // under the game once it is complete.
+    uint32_t bit = 1 << (id % 32);
+    if (str_ctx.data_read_map[id / 32] & bit)
+        return;
+
+    CdGetSector(&(str_ctx.data[offset]), 2016 / 4);
+
+    str_ctx.data_read_map[id / 32] |= bit;
+    str_ctx.data_length       = sector_header.bs_length;
+    str_ctx.data_sector_count = sector_header.sector_count;
+    str_ctx.data_sectors_read++;
+}
+
 void cd_sector_handler(void) {
     StreamBuffer *frame = &str_ctx.frames[str_ctx.cur_frame];
 
@@ -95,6 +139,11 @@ void cd_sector_handler(void) {
         return;
     }
 
+    if (sector_header.type == 0x8002) {
+        cd_data_handler();
+        return;
+    }
+
     // Ignore any non-MDEC sectors that might be present in the stream.
     if (sector_header.type != 0x8001)
         return;
@@ -220,6 +269,8 @@ void STR_StartStream(const char* path) {
     str_ctx.sector_pending =  0;
     str_ctx.frame_ready    =  0;
 
+    clear_data_sectors();
+
     CdSync(0, 0);
 
     // Configure the CD drive to read at 2x speed and to play any XA-ADPCM
@@ -244,6 +295,11 @@ void STR_StopStream(void)
     ExitCriticalSection();
     stage.str_playing = false;
     gameloop = lastloop;
+
+    // The data buffer only belongs to this stream, STR_GetDataSize() keeps
+    // reporting what was read until the next one starts.
+    str_ctx.data      = NULL;
+    str_ctx.data_size = 0;
 }
 
 void STR_Proccess(void)
@@ -309,4 +365,25 @@ void STR_Proccess(void)
         str_ctx.slices[str_ctx.cur_slice],
         BLOCK_SIZE * str_ctx.slice_pos.h / 2
     );
-}
\ No newline at end of file
+}
+
+// Sets the buffer data sectors are copied into, which has to be set before
+// STR_StartStream() and have room for a whole number of 2016 byte sectors.
+// The buffer is only used for the next stream, STR_StopStream() forgets it.
+void STR_SetDataBuffer(void *buffer, size_t size)
+{
+    str_ctx.data      = (uint8_t *)buffer;
+    str_ctx.data_size = size;
+
+    clear_data_sectors();
+}
+
+// Returns the size of the data once every one of its sectors has been read,
+// so a movie can carry small files (e.g. the next stage's assets) to the game
+// without the drive having to seek away from it.
+size_t STR_GetDataSize(void)
+{
+    if (!str_ctx.data_sector_count || str_ctx.data_sectors_read < str_ctx.data_sector_count)
+        return 0;
+    return str_ctx.data_length;
+}
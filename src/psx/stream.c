@@ -39,6 +39,14 @@ static int _get_default_timer_rate(void) {
     return (GetVideoMode() == MODE_PAL) ? 50 : 60;
 }
 
+static uint16_t _get_pitch(const Stream_Context *ctx, int index) {
+    return ctx->config.pitch[index] ? ctx->config.pitch[index] : 0x1000;
+}
+
+static size_t _get_interleave(const Stream_Context *ctx, int index) {
+    return (ctx->config.interleave * _get_pitch(ctx, index)) >> 12;
+}
+
 /* Interrupt handlers */
 
 static void _spu_irq_handler(void) {
@@ -99,13 +107,14 @@ static void _spu_irq_handler(void) {
 
     SPU_IRQ_ADDR = getSPUAddr(address);
 
+    int index = 0;
     for (uint32_t ch = 0, mask = ctx->config.channel_mask; mask; ch++, mask >>= 1) {
         if (!(mask & 1))
             continue;
 
-        SPU_CH_FREQ     (ch) = getSPUSampleRate(sample_rate);
+        SPU_CH_FREQ     (ch) = (getSPUSampleRate(sample_rate) * _get_pitch(ctx, index)) >> 12;
         SPU_CH_LOOP_ADDR(ch) = getSPUAddr(address + offset);
-        offset              += ctx->config.interleave;
+        offset              += _get_interleave(ctx, index++);
     
         // Make sure this channel's data ends with an appropriate loop flag.
         //ptr[offset - 15] |= 0x03;
@@ -130,9 +139,10 @@ void Stream_Init(Stream_Context *ctx, const Stream_Config *config) {
     __builtin_memcpy(&(ctx->config), config, sizeof(Stream_Config));
 
     ctx->num_channels = 0;
+    ctx->chunk_size   = 0;
     for (uint32_t mask = config->channel_mask; mask; mask >>= 1) {
         if (mask & 1)
-            ctx->num_channels++;
+            ctx->chunk_size += _get_interleave(ctx, ctx->num_channels++);
     }
 
     assert(ctx->num_channels);
@@ -142,7 +152,6 @@ void Stream_Init(Stream_Context *ctx, const Stream_Config *config) {
         ctx->config.timer_function = &_default_timer_function;
     }
 
-    ctx->chunk_size        = ctx->config.interleave * ctx->num_channels;
     ctx->samples_per_chunk = ctx->config.interleave / 16 * 28;
     ctx->new_sample_rate   = ctx->config.sample_rate;
     ctx->buffer.data       = malloc(config->buffer_size);
@@ -188,16 +197,17 @@ bool Stream_Start(Stream_Context *ctx, bool resume) {
 
     SpuSetKey(0, ctx->config.channel_mask);
 
+    int index = 0;
     for (uint32_t ch = 0, mask = ctx->config.channel_mask; mask; ch++, mask >>= 1) {
         if (!(mask & 1))
             continue;
 
         SPU_CH_ADDR (ch) = getSPUAddr(address);
-        SPU_CH_FREQ (ch) = getSPUSampleRate(sample_rate);
+        SPU_CH_FREQ (ch) = (getSPUSampleRate(sample_rate) * _get_pitch(ctx, index)) >> 12;
         SPU_CH_ADSR1(ch) = 0x00ff;
         SPU_CH_ADSR2(ch) = 0x0000;
 
-        address += ctx->config.interleave;
+        address += _get_interleave(ctx, index++);
     }
 
     _spu_irq_handler();
@@ -51,6 +51,12 @@ typedef Stream_Time (*Stream_TimerFunction)(void);
  * optional timer rate are in Hertz, while the interleave and buffer size are in
  * bytes.
  *
+ * The optional pitch array lets each channel of the stream (in the same order
+ * as the channel mask) play at a fraction of the sample rate, in 4.12 fixed
+ * point (0 is the same as 0x1000). Such channels take up interleave * pitch
+ * bytes in each chunk, which must be a whole number of ADPCM blocks. The
+ * buffer size must be a multiple of the resulting chunk size.
+ *
  * The refill threshold, refill callback, underrun callback and timer function
  * are optional. If provided, the callbacks will be invoked by the SPU IRQ
  * handler once the FIFO's length goes below the specified threshold and once it
@@ -62,6 +68,7 @@ typedef struct {
     uint32_t spu_address, channel_mask;
     size_t   interleave, buffer_size, refill_threshold;
     int      sample_rate, timer_rate;
+    uint16_t pitch[24];
 
     Stream_Callback      refill_callback, underrun_callback;
     Stream_TimerFunction timer_function;
@@ -9,9 +9,18 @@
 #include "save.h"
 
 #include "stage.h"
-                  
+
+#ifdef PSXF_PC
+    #include <fcntl.h>
+    #include <unistd.h>
+
+    //Save to a host file, mapping the BIOS open modes onto POSIX ones
+    #define savetitle "funkin.sav"
+    #define open(path, mode) open(path, ((mode) & 0x0200) ? (O_WRONLY | O_CREAT) : ((mode) & 0x0002) ? O_WRONLY : O_RDONLY, 0644)
+#else
             //HAS to be BASCUS-scusid,somename
-#define savetitle "bu00:BASCUS-00000funkin"
+    #define savetitle "bu00:BASCUS-00000funkin"
+#endif
 #define savename  "PSXFunkin"
 
 static const uint8_t saveIconPalette[32] = 
@@ -61,11 +61,17 @@ Stage stage;
 Debug debug;
 
 //Stage music functions
+static uint32_t Stage_GetVocalRoles(void)
+{
+    //Vocals that get cut when the player misses, the opponent keeps singing on their own stem
+    return AUDIO_ROLE_MASK(AudioRole_Vocal) | AUDIO_ROLE_MASK((stage.mode == StageMode_Swap) ? AudioRole_Opponent : AudioRole_Player);
+}
+
 static void Stage_StartVocal(void)
 {
     if (!(stage.flag & STAGE_FLAG_VOCAL_ACTIVE))
     {
-        Audio_SetVolume(2, 0x3FFF, 0x3FFF);
+        Audio_SetRoleVolume(Stage_GetVocalRoles(), 0x3FFF);
 //        Audio_ChannelXA(stage.stage_def->music_channel);
         stage.flag |= STAGE_FLAG_VOCAL_ACTIVE;
     }
@@ -75,7 +81,7 @@ static void Stage_CutVocal(void)
 {
     if (stage.flag & STAGE_FLAG_VOCAL_ACTIVE)
     {
-        Audio_SetVolume(2, 0x0000, 0x0000);
+        Audio_SetRoleVolume(Stage_GetVocalRoles(), 0x0000);
 //        Audio_ChannelXA(stage.stage_def->music_channel + 1);
         stage.flag &= ~STAGE_FLAG_VOCAL_ACTIVE;
     }
@@ -147,16 +153,17 @@ static void Stage_ScrollCamera(void)
 }
 
 //Stage section functions
-static void Stage_ChangeBPM(uint16_t bpm, uint16_t step)
+static void Stage_ChangeBPM(uint16_t bpm, uint16_t step, fixed_t time)
 {
+    //Update timing base, section start times are precomputed by funkinchartpak
+    stage.time_base = time;
+    stage.step_base = step;
+    
     //Update last BPM
+    if (stage.step_crochet && bpm == stage.last_bpm)
+        return;
     stage.last_bpm = bpm;
     
-    //Update timing base
-    if (stage.step_crochet)
-        stage.time_base += FIXED_DIV(((fixed_t)step - stage.step_base) << FIXED_SHIFT, stage.step_crochet);
-    stage.step_base = step;
-    
     //Get new crochet and times
     stage.step_crochet = ((fixed_t)bpm << FIXED_SHIFT) * 8 / 240; //15/12/24
     stage.step_time = FIXED_DIV(FIXED_DEC(12,1), stage.step_crochet);
@@ -167,49 +174,22 @@ static void Stage_ChangeBPM(uint16_t bpm, uint16_t step)
     stage.early_sus_safe = stage.early_safe * 2 / 5;
 }
 
-static Section *Stage_GetPrevSection(Section *section)
-{
-    if (section > stage.sections)
-        return section - 1;
-    return NULL;
-}
-
-static uint16_t Stage_GetSectionStart(Section *section)
+//Note hit detection
+static uint16_t *Stage_GetLane(uint8_t lane)
 {
-    Section *prev = Stage_GetPrevSection(section);
-    if (prev == NULL)
-        return 0;
-    return prev->end;
+    //Move lane cursor up to cur_note, notes before it can't be hit anymore
+    uint16_t cur = stage.cur_note - stage.notes;
+    uint16_t *index = stage.lane_notes[lane];
+    while (*index < cur)
+        index++;
+    return stage.lane_notes[lane] = index;
 }
 
-//Section scroll structure
-typedef struct
-{
-    fixed_t start;   //Seconds
-    fixed_t length;  //Seconds
-    uint16_t start_step;  //Sub-steps
-    uint16_t length_step; //Sub-steps
-    
-    fixed_t size; //Note height
-} SectionScroll;
-
-static void Stage_GetSectionScroll(SectionScroll *scroll, Section *section)
+static fixed_t Stage_GetPieceFP(const Sustain *sustain, uint16_t piece)
 {
-    //Get BPM
-    uint16_t bpm = section->flag & SECTION_FLAG_BPM_MASK;
-    
-    //Get section step info
-    scroll->start_step = Stage_GetSectionStart(section);
-    scroll->length_step = section->end - scroll->start_step;
-    
-    //Get section time length
-    scroll->length = (scroll->length_step * FIXED_DEC(15,1) / 12) * 24 / bpm;
-    
-    //Get note height
-    scroll->size = FIXED_MUL(stage.speed, scroll->length * (12 * 150) / scroll->length_step) + FIXED_UNIT;
+    return (fixed_t)(sustain->pos + piece * 12) << FIXED_SHIFT;
 }
 
-//Note hit detection
 static uint8_t Stage_HitNote(PlayerState *this, uint8_t type, fixed_t offset)
 {
     //Get hit type
@@ -315,8 +295,9 @@ static void Stage_MissNote(PlayerState *this)
 static void Stage_NoteCheck(PlayerState *this, uint8_t type)
 {
     //Perform note check
-    for (Note *note = stage.cur_note;; note++)
+    for (uint16_t *index = Stage_GetLane(type & (NOTE_FLAG_OPPONENT | 0x3));; index++)
     {
+        Note *note = &stage.notes[*index];
         if (!(note->type & NOTE_FLAG_MINE))
         {
             //Check if note can be hit
@@ -325,7 +306,7 @@ static void Stage_NoteCheck(PlayerState *this, uint8_t type)
                 break;
             if (note_fp + stage.late_safe < stage.note_scroll)
                 continue;
-            if ((note->type & NOTE_FLAG_HIT) || (note->type & (NOTE_FLAG_OPPONENT | 0x3)) != type || (note->type & NOTE_FLAG_SUSTAIN))
+            if (note->type & NOTE_FLAG_HIT)
                 continue;
             
             //Hit the note
@@ -346,7 +327,7 @@ static void Stage_NoteCheck(PlayerState *this, uint8_t type)
                 break;
             if (note_fp + (stage.late_safe * 2 / 5) < stage.note_scroll)
                 continue;
-            if ((note->type & NOTE_FLAG_HIT) || (note->type & (NOTE_FLAG_OPPONENT | 0x3)) != type || (note->type & NOTE_FLAG_SUSTAIN))
+            if (note->type & NOTE_FLAG_HIT)
                 continue;
             
             //Hit the mine
@@ -387,27 +368,32 @@ static void Stage_NoteCheck(PlayerState *this, uint8_t type)
 
 static void Stage_SustainCheck(PlayerState *this, uint8_t type)
 {
-    //Perform note check
-    for (Note *note = stage.cur_note;; note++)
+    //Perform sustain check
+    for (Sustain *sustain = stage.cur_sustain;; sustain++)
     {
-        //Check if note can be hit
-        fixed_t note_fp = (fixed_t)note->pos << FIXED_SHIFT;
-        if (note_fp - stage.early_sus_safe > stage.note_scroll)
+        //Check if sustain can be held
+        if (Stage_GetPieceFP(sustain, 0) - stage.early_sus_safe > stage.note_scroll)
             break;
-        if (note_fp + stage.late_sus_safe < stage.note_scroll)
-            continue;
-        if ((note->type & NOTE_FLAG_HIT) || (note->type & (NOTE_FLAG_OPPONENT | 0x3)) != type || !(note->type & NOTE_FLAG_SUSTAIN))
+        if ((sustain->type & (NOTE_FLAG_OPPONENT | 0x3)) != type)
             continue;
         
-        //Hit the note
-        note->type |= NOTE_FLAG_HIT;
-        
-        this->character->set_anim(this->character, note_anims[type & 0x3][(note->type & NOTE_FLAG_ALT_ANIM) != 0]);
-        
-        Stage_StartVocal();
-        this->health += 230;
-        this->arrow_hitan[type & 0x3] = stage.step_time;
+        //Hit pieces in range, pieces that went past are missed by Stage_DrawSustains
+        while (sustain->done < sustain->length)
+        {
+            fixed_t piece_fp = Stage_GetPieceFP(sustain, sustain->done);
+            if (piece_fp - stage.early_sus_safe > stage.note_scroll || piece_fp + stage.late_sus_safe < stage.note_scroll)
+                break;
             
+            //Hit the piece
+            sustain->done++;
+            sustain->type |= NOTE_FLAG_HIT;
+            
+            this->character->set_anim(this->character, note_anims[type & 0x3][(sustain->type & NOTE_FLAG_ALT_ANIM) != 0]);
+            
+            Stage_StartVocal();
+            this->health += 230;
+            this->arrow_hitan[type & 0x3] = stage.step_time;
+        }
     }
 }
 
@@ -463,32 +449,49 @@ static void Stage_ProcessPlayer(PlayerState *this, Pad *pad, bool playing)
             uint8_t i = ((this->character == stage.opponent) || (this->character == stage.opponent2)) ? NOTE_FLAG_OPPONENT : 0;
             
             uint8_t hit[4] = {0, 0, 0, 0};
-            for (Note *note = stage.cur_note;; note++)
+            fixed_t pending_fp[4] = {0x7FFFFFFF, 0x7FFFFFFF, 0x7FFFFFFF, 0x7FFFFFFF};
+            for (uint8_t j = 0; j < 4; j++)
             {
-                //Check if note can be hit
-                fixed_t note_fp = (fixed_t)note->pos << FIXED_SHIFT;
-                if (note_fp - stage.early_safe - FIXED_DEC(12,1) > stage.note_scroll)
-                    break;
-                if (note_fp + stage.late_safe < stage.note_scroll)
-                    continue;
-                if ((note->type & NOTE_FLAG_MINE) || (note->type & NOTE_FLAG_OPPONENT) != i)
-                    continue;
-                
-                //Handle note hit
-                if (!(note->type & NOTE_FLAG_SUSTAIN))
+                for (uint16_t *index = Stage_GetLane(j | i);; index++)
                 {
-                    if (note->type & NOTE_FLAG_HIT)
+                    //Check if note can be hit
+                    Note *note = &stage.notes[*index];
+                    fixed_t note_fp = (fixed_t)note->pos << FIXED_SHIFT;
+                    if (note_fp - stage.early_safe - FIXED_DEC(12,1) > stage.note_scroll)
+                        break;
+                    if (note_fp + stage.late_safe < stage.note_scroll)
+                        continue;
+                    if (note->type & (NOTE_FLAG_MINE | NOTE_FLAG_HIT))
                         continue;
+                    
+                    //Handle note hit
                     if (stage.note_scroll >= note_fp)
-                        hit[note->type & 0x3] |= 1;
-                    else if (!(hit[note->type & 0x3] & 8))
-                        hit[note->type & 0x3] |= 2;
+                        hit[j] |= 1;
+                    else if (note_fp < pending_fp[j])
+                        pending_fp[j] = note_fp;
                 }
-                else if (!(hit[note->type & 0x3] & 2))
+            }
+            
+            for (Sustain *sustain = stage.cur_sustain;; sustain++)
+            {
+                //Check if sustain can be held
+                if (Stage_GetPieceFP(sustain, 0) - stage.early_safe - FIXED_DEC(12,1) > stage.note_scroll)
+                    break;
+                if (sustain->done >= sustain->length || (sustain->type & NOTE_FLAG_OPPONENT) != i)
+                    continue;
+                
+                fixed_t next_fp = Stage_GetPieceFP(sustain, sustain->done);
+                fixed_t last_fp = Stage_GetPieceFP(sustain, sustain->length - 1);
+                if (next_fp - stage.early_safe - FIXED_DEC(12,1) > stage.note_scroll || last_fp + stage.late_safe < stage.note_scroll)
+                    continue;
+                
+                //Hold sustain unless a note has to be pressed first
+                uint8_t j = sustain->type & 0x3;
+                if (next_fp < pending_fp[j])
                 {
-                    if (stage.note_scroll <= note_fp)
-                        hit[note->type & 0x3] |= 4;
-                    hit[note->type & 0x3] |= 8;
+                    if (stage.note_scroll <= last_fp)
+                        hit[j] |= 4;
+                    hit[j] |= 8;
                 }
             }
             
@@ -972,49 +975,131 @@ static void Stage_DrawStrum(uint8_t i, RECT *note_src, RECT_FIXED *note_dst)
     }
 }
 
-static void Stage_DrawNotes(void)
+static void Stage_DrawSustains(void)
 {
     //Check if opponent should draw as bot
     uint8_t bot = (stage.mode >= StageMode_2P) ? 0 : NOTE_FLAG_OPPONENT;
     
-    //Initialize scroll state
-    SectionScroll scroll;
-    scroll.start = stage.time_base;
-    
-    Section *scroll_section = stage.section_base;
-    Stage_GetSectionScroll(&scroll, scroll_section);
-    
-    //Push scroll back until cur_note is properly contained
-    while (scroll.start_step > stage.cur_note->pos)
+    //Draw sustains
+    const SustainScroll *scroll = &stage.sustain_scrolls[stage.cur_sustain - stage.sustains];
+    for (Sustain *sustain = stage.cur_sustain; sustain->pos != 0xFFFF; sustain++, scroll++)
     {
-        //Look for previous section
-        Section *prev_section = Stage_GetPrevSection(scroll_section);
-        if (prev_section == NULL)
+        //Get sustain information
+        uint8_t i = ((sustain->type ^ stage.note_swap) & NOTE_FLAG_OPPONENT) != 0;
+        PlayerState *this = &stage.player_state[i];
+        uint8_t lane = sustain->type & 0x7;
+        
+        //Miss pieces that went past without being held
+        while (sustain->done < sustain->length && !((sustain->type ^ stage.note_swap) & bot))
+        {
+            if (Stage_GetPieceFP(sustain, sustain->done) + stage.late_sus_safe >= stage.note_scroll)
+                break;
+            
+            sustain->done++;
+            sustain->type &= ~NOTE_FLAG_HIT;
+            if (stage.mode < StageMode_Net1 || i == ((stage.mode == StageMode_Net1) ? 0 : 1))
+            {
+                //Missed piece
+                Stage_CutVocal();
+                Stage_MissNote(this);
+                this->health -= 475;
+            }
+        }
+        
+        fixed_t y = note_y[lane] + FIXED_MUL(stage.speed, (scroll->time - stage.song_time) * 150) - scroll->size;
+        fixed_t end_y = note_y[lane] + FIXED_MUL(stage.speed, (scroll->end - stage.song_time) * 150) - scroll->size;
+        
+        //Check if went above screen
+        if (end_y + scroll->size < FIXED_DEC(-16 - screen.SCREEN_HEIGHT2, 1))
+        {
+            //Wait for the last piece to exit late time
+            if (Stage_GetPieceFP(sustain, sustain->length - 1) + stage.late_safe >= stage.note_scroll)
+                continue;
+            
+            //Update current sustain
+            sustain->done = sustain->length;
+            if (sustain == stage.cur_sustain)
+                stage.cur_sustain++;
+            continue;
+        }
+        
+        //Don't draw if below screen
+        RECT note_src;
+        RECT_FIXED note_dst;
+        if (y > FIXED_DEC(screen.SCREEN_HEIGHT,2))
             break;
         
-        //Push scroll back
-        scroll_section = prev_section;
-        Stage_GetSectionScroll(&scroll, scroll_section);
-        scroll.start -= scroll.length;
+        //Check for sustain clipping
+        bool clip = ((sustain->type ^ stage.note_swap) & (bot | NOTE_FLAG_HIT)) || ((this->pad_held & note_key[sustain->type & 0x3]) && (Stage_GetPieceFP(sustain, sustain->length - 1) + stage.late_sus_safe >= stage.note_scroll));
+        
+        //Draw body as one quad stretched down to the end
+        fixed_t top = (clip && y < note_y[lane]) ? note_y[lane] : y;
+        if (top < end_y)
+        {
+            note_src.x = 160;
+            note_src.y = (sustain->type & 0x3) << 5;
+            note_src.w = 32;
+            note_src.h = 16;
+            
+            note_dst.x = stage.noteshakex + note_x[lane] - FIXED_DEC(16,1);
+            note_dst.y = stage.noteshakey + top;
+            note_dst.w = note_src.w << FIXED_SHIFT;
+            note_dst.h = end_y - top;
+            
+            if (stage.prefs.downscroll)
+                note_dst.y = -note_dst.y - note_dst.h;
+            //draw for opponent
+            if (stage.prefs.middlescroll && sustain->type & NOTE_FLAG_OPPONENT)
+                Stage_BlendTex(&stage.tex_hud0, &note_src, &note_dst, stage.bump, 1);
+            else
+                Stage_DrawTex(&stage.tex_hud0, &note_src, &note_dst, stage.bump);
+        }
+        
+        //Draw end
+        fixed_t end_clip = clip ? (note_y[lane] - end_y) : 0;
+        if (end_clip < 0)
+            end_clip = 0;
+        if (end_clip < (24 << FIXED_SHIFT))
+        {
+            note_src.x = 160;
+            note_src.y = ((sustain->type & 0x3) << 5) + 4 + (end_clip >> FIXED_SHIFT);
+            note_src.w = 32;
+            note_src.h = 28 - (end_clip >> FIXED_SHIFT);
+            
+            note_dst.x = stage.noteshakex + note_x[lane] - FIXED_DEC(16,1);
+            note_dst.y = stage.noteshakey + end_y + end_clip;
+            note_dst.w = note_src.w << FIXED_SHIFT;
+            note_dst.h = note_src.h << FIXED_SHIFT;
+            
+            if (stage.prefs.downscroll)
+            {
+                note_dst.y = -note_dst.y;
+                note_dst.h = -note_dst.h;
+            }
+            //draw for opponent
+            if (stage.prefs.middlescroll && sustain->type & NOTE_FLAG_OPPONENT)
+                Stage_BlendTex(&stage.tex_hud0, &note_src, &note_dst, stage.bump, 1);
+            else
+                Stage_DrawTex(&stage.tex_hud0, &note_src, &note_dst, stage.bump);
+        }
     }
+}
+
+static void Stage_DrawNotes(void)
+{
+    //Check if opponent should draw as bot
+    uint8_t bot = (stage.mode >= StageMode_2P) ? 0 : NOTE_FLAG_OPPONENT;
     
     //Draw notes
-    for (Note *note = stage.cur_note; note->pos != 0xFFFF; note++)
+    const NoteScroll *scroll = &stage.note_scrolls[stage.cur_note - stage.notes];
+    for (Note *note = stage.cur_note; note->pos != 0xFFFF; note++, scroll++)
     {
-        //Update scroll
-        while (note->pos >= scroll_section->end)
-        {
-            //Push scroll forward
-            scroll.start += scroll.length;
-            Stage_GetSectionScroll(&scroll, ++scroll_section);
-        }
-        
         //Get note information
         uint8_t i = ((note->type ^ stage.note_swap) & NOTE_FLAG_OPPONENT) != 0;
         PlayerState *this = &stage.player_state[i];
         
         fixed_t note_fp = (fixed_t)note->pos << FIXED_SHIFT;
-        fixed_t time = (scroll.start - stage.song_time) + (scroll.length * (note->pos - scroll.start_step) / scroll.length_step);
+        fixed_t time = scroll->time - stage.song_time;
         fixed_t y = note_y[(note->type & 0x7)] + FIXED_MUL(stage.speed, time * 150);
         
         //Check if went above screen
@@ -1045,83 +1130,11 @@ static void Stage_DrawNotes(void)
             //Don't draw if below screen
             RECT note_src;
             RECT_FIXED note_dst;
-            if (y > (FIXED_DEC(screen.SCREEN_HEIGHT,2) + scroll.size) || note->pos == 0xFFFF)
+            if (y > (FIXED_DEC(screen.SCREEN_HEIGHT,2) + scroll->size) || note->pos == 0xFFFF)
                 break;
             
             //Draw note
-            if (note->type & NOTE_FLAG_SUSTAIN)
-            {
-                //Check for sustain clipping
-                fixed_t clip;
-                y -= scroll.size;
-                if (((note->type ^ stage.note_swap) & (bot | NOTE_FLAG_HIT)) || ((this->pad_held & note_key[note->type & 0x3]) && (note_fp + stage.late_sus_safe >= stage.note_scroll)))
-                {
-                    clip = note_y[(note->type & 0x7)] - y;
-                    if (clip < 0)
-                        clip = 0;
-                }
-                else
-                {
-                    clip = 0;
-                }
-                
-                //Draw sustain
-                if (note->type & NOTE_FLAG_SUSTAIN_END)
-                {
-                    if (clip < (24 << FIXED_SHIFT))
-                    {
-                        note_src.x = 160;
-                        note_src.y = ((note->type & 0x3) << 5) + 4 + (clip >> FIXED_SHIFT);
-                        note_src.w = 32;
-                        note_src.h = 28 - (clip >> FIXED_SHIFT);
-                        
-                        note_dst.x = stage.noteshakex + note_x[(note->type & 0x7)] - FIXED_DEC(16,1);
-                        note_dst.y = stage.noteshakey + y + clip;
-                        note_dst.w = note_src.w << FIXED_SHIFT;
-                        note_dst.h = (note_src.h << FIXED_SHIFT);
-                        
-                        if (stage.prefs.downscroll)
-                        {
-                            note_dst.y = -note_dst.y;
-                            note_dst.h = -note_dst.h;
-                        }
-                        //draw for opponent
-                        if (stage.prefs.middlescroll && note->type & NOTE_FLAG_OPPONENT)
-                            Stage_BlendTex(&stage.tex_hud0, &note_src, &note_dst, stage.bump, 1);
-                        else
-                            Stage_DrawTex(&stage.tex_hud0, &note_src, &note_dst, stage.bump);
-                    }
-                }
-                else
-                {
-                    //Get note height
-                    fixed_t next_time = (scroll.start - stage.song_time) + (scroll.length * (note->pos + 12 - scroll.start_step) / scroll.length_step);
-                    fixed_t next_y = note_y[(note->type & 0x7)] + FIXED_MUL(stage.speed, next_time * 150) - scroll.size;
-                    fixed_t next_size = next_y - y;
-                    
-                    if (clip < next_size)
-                    {
-                        note_src.x = 160;
-                        note_src.y = ((note->type & 0x3) << 5);
-                        note_src.w = 32;
-                        note_src.h = 16;
-                        
-                        note_dst.x = stage.noteshakex + note_x[(note->type & 0x7)] - FIXED_DEC(16,1);
-                        note_dst.y = stage.noteshakey + y + clip;
-                        note_dst.w = note_src.w << FIXED_SHIFT;
-                        note_dst.h = (next_y - y) - clip;
-                        
-                        if (stage.prefs.downscroll)
-                            note_dst.y = -note_dst.y - note_dst.h;
-                        //draw for opponent
-                        if (stage.prefs.middlescroll && note->type & NOTE_FLAG_OPPONENT)
-                            Stage_BlendTex(&stage.tex_hud0, &note_src, &note_dst, stage.bump, 1);
-                        else
-                            Stage_DrawTex(&stage.tex_hud0, &note_src, &note_dst, stage.bump);
-                    }
-                }
-            }
-            else if (note->type & NOTE_FLAG_MINE)
+            if (note->type & NOTE_FLAG_MINE)
             {
                 //Don't draw if already hit
                 if (note->type & NOTE_FLAG_HIT)
@@ -1195,6 +1208,9 @@ static void Stage_DrawNotes(void)
             }
         }
     }
+    
+    //Draw sustains behind the notes
+    Stage_DrawSustains();
 }
 
 int drawshit = 0;
@@ -1322,26 +1338,43 @@ static void Stage_LoadChart(void)
         free(stage.chart_data);
     stage.chart_data = IO_Read(chart_path);
     uint8_t *chart_byte = (uint8_t*)stage.chart_data;
-
-        //Directly use section and notes pointers
-        stage.sections = (Section*)(chart_byte + 6);
-        stage.notes = (Note*)(chart_byte + ((uint16_t*)stage.chart_data)[2]);
-        
-        for (Note *note = stage.notes; note->pos != 0xFFFF; note++)
-            stage.num_notes++;
+    const ChartHeader *header = (const ChartHeader*)stage.chart_data;
     
-    //Count max scores
-    stage.player_state[0].max_score = 0;
-    stage.player_state[1].max_score = 0;
-    for (Note *note = stage.notes; note->pos != 0xFFFF; note++)
+    //Validate header
+    if (memcmp(header->magic, CHART_MAGIC, 4) != 0)
     {
-        if (note->type & (NOTE_FLAG_SUSTAIN | NOTE_FLAG_MINE))
-            continue;
-        if (note->type & NOTE_FLAG_OPPONENT)
-            stage.player_state[1].max_score += 35;
-        else
-            stage.player_state[0].max_score += 35;
+        sprintf(error_msg, "[Stage_LoadChart] %s is not a chart", chart_path);
+        ErrorLock();
+        return;
+    }
+    if (header->version != CHART_VERSION || (header->flags & ~CHART_FLAGS_KNOWN))
+    {
+        sprintf(error_msg, "[Stage_LoadChart] %s is version %d flags %X, expected version %d", chart_path, header->version, header->flags, CHART_VERSION);
+        ErrorLock();
+        return;
+    }
+    if (MUtil_CRC32(header + 1, header->size) != header->crc)
+    {
+        sprintf(error_msg, "[Stage_LoadChart] %s is corrupted", chart_path);
+        ErrorLock();
+        return;
     }
+    
+    //Directly use chart tables
+    stage.sections = (Section*)(chart_byte + header->section_offset);
+    stage.notes = (Note*)(chart_byte + header->note_offset);
+    stage.note_scrolls = (NoteScroll*)(chart_byte + header->note_scroll_offset);
+    stage.sustains = (Sustain*)(chart_byte + header->sustain_offset);
+    stage.sustain_scrolls = (SustainScroll*)(chart_byte + header->sustain_scroll_offset);
+    stage.num_notes = header->num_notes;
+    
+    uint16_t *lane_table = (uint16_t*)(chart_byte + header->lane_offset);
+    for (int i = 0; i < NOTE_LANES; i++)
+        stage.lane_notes[i] = lane_table + NOTE_LANES + lane_table[i];
+    
+    //Get max scores
+    stage.player_state[0].max_score = header->max_score[0];
+    stage.player_state[1].max_score = header->max_score[1];
     if (stage.mode >= StageMode_2P && stage.player_state[1].max_score > stage.player_state[0].max_score)
         stage.max_score = stage.player_state[1].max_score;
     else
@@ -1349,14 +1382,13 @@ static void Stage_LoadChart(void)
     
     stage.cur_section = stage.sections;
     stage.cur_note = stage.notes;
+    stage.cur_sustain = stage.sustains;
     
-    stage.speed = *((fixed_t*)stage.chart_data);
+    stage.speed = header->speed;
     
     stage.step_crochet = 0;
-    stage.time_base = 0;
-    stage.step_base = 0;
     stage.section_base = stage.cur_section;
-    Stage_ChangeBPM(stage.cur_section->flag & SECTION_FLAG_BPM_MASK, 0);
+    Stage_ChangeBPM(stage.cur_section->flag & SECTION_FLAG_BPM_MASK, 0, stage.cur_section->start);
 }
 
 static void Stage_LoadSFX(void)
@@ -1985,7 +2017,7 @@ void Stage_Tick(void)
                         
                         //Update BPM
                         uint16_t next_bpm = stage.cur_section->flag & SECTION_FLAG_BPM_MASK;
-                        Stage_ChangeBPM(next_bpm, end);
+                        Stage_ChangeBPM(next_bpm, end, stage.cur_section->start);
                         stage.section_base = stage.cur_section;
                         
                         //Recalculate scroll based off new BPM
@@ -2109,7 +2141,9 @@ void Stage_Tick(void)
                 case StageMode_Swap:
                 {
                     //Handle player 1 inputs
+                    Timer_StartProfileSection(ProfileSection_ProcessPlayer);
                     Stage_ProcessPlayer(&stage.player_state[0], &pad_state, playing);
+                    Timer_EndProfileSection(ProfileSection_ProcessPlayer);
                     
                     //Handle opponent notes
                     uint8_t opponent_anote = CharAnim_Idle;
@@ -2126,14 +2160,27 @@ void Stage_Tick(void)
                             //Opponent hits note
                             stage.player_state[1].arrow_hitan[note->type & 0x3] = stage.step_time;
                             Stage_StartVocal();
-                            if (note->type & NOTE_FLAG_SUSTAIN)
-                                opponent_snote = note_anims[note->type & 0x3][(note->type & NOTE_FLAG_ALT_ANIM) != 0];
-                            else
-                                opponent_anote = note_anims[note->type & 0x3][(note->type & NOTE_FLAG_ALT_ANIM) != 0];
+                            opponent_anote = note_anims[note->type & 0x3][(note->type & NOTE_FLAG_ALT_ANIM) != 0];
                             note->type |= NOTE_FLAG_HIT;
                         }
                     }
                     
+                    for (Sustain *sustain = stage.cur_sustain; sustain->pos <= (stage.note_scroll >> FIXED_SHIFT); sustain++)
+                    {
+                        //Opponent sustain hits
+                        if (!playing || !((sustain->type ^ stage.note_swap) & NOTE_FLAG_OPPONENT))
+                            continue;
+                        while (sustain->done < sustain->length && (sustain->pos + sustain->done * 12) <= (stage.note_scroll >> FIXED_SHIFT))
+                        {
+                            //Opponent hits piece
+                            sustain->done++;
+                            sustain->type |= NOTE_FLAG_HIT;
+                            stage.player_state[1].arrow_hitan[sustain->type & 0x3] = stage.step_time;
+                            Stage_StartVocal();
+                            opponent_snote = note_anims[sustain->type & 0x3][(sustain->type & NOTE_FLAG_ALT_ANIM) != 0];
+                        }
+                    }
+                    
                     if (opponent_anote != CharAnim_Idle)
                         stage.player_state[1].character->set_anim(stage.player_state[1].character, opponent_anote);
                     else if (opponent_snote != CharAnim_Idle)
@@ -2144,8 +2191,10 @@ void Stage_Tick(void)
                 case StageMode_2P:
                 {
                     //Handle player 1 and 2 inputs
+                    Timer_StartProfileSection(ProfileSection_ProcessPlayer);
                     Stage_ProcessPlayer(&stage.player_state[0], &pad_state, playing);
                     Stage_ProcessPlayer(&stage.player_state[1], &pad_state_2, playing);
+                    Timer_EndProfileSection(ProfileSection_ProcessPlayer);
                     break;
                 }
             }
@@ -2190,10 +2239,14 @@ void Stage_Tick(void)
                 }
             
                 //Tick note splashes
+                Timer_StartProfileSection(ProfileSection_ObjectList);
                 ObjectList_Tick(&stage.objlist_splash);
+                Timer_EndProfileSection(ProfileSection_ObjectList);
                 
                 //Draw stage notes
+                Timer_StartProfileSection(ProfileSection_DrawNotes);
                 Stage_DrawNotes();
+                Timer_EndProfileSection(ProfileSection_DrawNotes);
                 
                 //Draw note HUD
                 RECT note_src = {0, 0, 32, 32};
@@ -2255,7 +2308,9 @@ void Stage_Tick(void)
                 stage.back->draw_fg(stage.back);
             
             //Tick foreground objects
+            Timer_StartProfileSection(ProfileSection_ObjectList);
             ObjectList_Tick(&stage.objlist_fg);
+            Timer_EndProfileSection(ProfileSection_ObjectList);
             
             //Tick characters
             if (stage.mode == StageMode_Swap)
@@ -2288,7 +2343,9 @@ void Stage_Tick(void)
                 stage.gf->tick(stage.gf);
             
             //Tick background objects
+            Timer_StartProfileSection(ProfileSection_ObjectList);
             ObjectList_Tick(&stage.objlist_bg);
+            Timer_EndProfileSection(ProfileSection_ObjectList);
             
             //Draw stage background
             if (stage.back->draw_bg != NULL)
@@ -130,6 +130,25 @@ typedef struct
 } StageDef;
 
 //Stage state
+#define CHART_MAGIC   "FCHT"
+#define CHART_VERSION 2
+
+#define CHART_FLAG_MINES (1 << 0) //Chart has mine notes
+#define CHART_FLAGS_KNOWN (CHART_FLAG_MINES)
+
+typedef struct
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t flags;
+    uint32_t size; //Size of the data following the header
+    uint32_t crc;  //CRC-32 of the data following the header
+    fixed_t speed;
+    uint16_t num_sections, num_notes, num_sustains, pad; //Not including the dummies
+    int32_t max_score[2];
+    uint32_t section_offset, note_offset, note_scroll_offset, lane_offset, sustain_offset, sustain_scroll_offset;
+} ChartHeader;
+
 #define SECTION_FLAG_OPPFOCUS (1 << 15) //Focus on opponent
 #define SECTION_FLAG_BPM_MASK 0x7FFF //1/24
 
@@ -137,6 +156,7 @@ typedef struct
 {
     uint16_t end; //1/12 steps
     uint16_t flag;
+    fixed_t start; //Seconds from the start of the song
 } Section;
 
 #define NOTE_FLAG_OPPONENT    (1 << 2) //Note is opponent's
@@ -146,12 +166,34 @@ typedef struct
 #define NOTE_FLAG_MINE        (1 << 6) //Note is a mine
 #define NOTE_FLAG_HIT         (1 << 7) //Note has been hit
 
+#define NOTE_LANES 8 //4 for each player, indexed by type & (NOTE_FLAG_OPPONENT | 0x3)
+
 typedef struct
 {
     uint16_t pos; //1/12 steps
     uint16_t type;
 } Note;
 
+typedef struct
+{
+    fixed_t time; //Seconds from the start of the song
+    fixed_t size; //Note height
+} NoteScroll;
+
+typedef struct
+{
+    uint16_t pos;    //First piece, 1/12 steps
+    uint16_t length; //Pieces, one per step
+    uint16_t type;
+    uint16_t done;   //Pieces that have been hit or missed
+} Sustain;
+
+typedef struct
+{
+    fixed_t time, end; //Seconds from the start of the song to the first and last piece
+    fixed_t size;      //Piece height
+} SustainScroll;
+
 typedef struct
 {
     Character *character;
@@ -215,7 +257,11 @@ typedef struct
     IO_Data chart_data;
     Section *sections;
     Note *notes;
+    NoteScroll *note_scrolls; //Parallel to notes
+    uint16_t *lane_notes[NOTE_LANES]; //Index of the first note in each lane that may still be hit, lanes end with the dummy note
     size_t num_notes;
+    Sustain *sustains;
+    SustainScroll *sustain_scrolls; //Parallel to sustains
     
     fixed_t speed;
     fixed_t step_crochet, step_time;
@@ -245,6 +291,7 @@ typedef struct
     
     Section *cur_section; //Current section
     Note *cur_note; //First visible and hittable note, used for drawing and hit detection
+    Sustain *cur_sustain; //First visible sustain
     
     fixed_t note_scroll, song_time, interp_time, interp_ms, interp_speed;
     
@@ -1,7 +1,7 @@
 #ifndef PSXF_GUARD_STR_H
 #define PSXF_GUARD_STR_H
 
-#include <psxcd.h>
+#include "psx.h"
 #include "stage.h"
 
 static volatile struct {
@@ -18,4 +18,7 @@ void STR_StartStream(const char* path);
 void STR_StopStream(void);
 void STR_Proccess(void);
 
+void STR_SetDataBuffer(void *buffer, size_t size);
+size_t STR_GetDataSize(void);
+
 #endif
\ No newline at end of file
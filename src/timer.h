@@ -34,6 +34,7 @@ uint32_t Timer_GetAnimfCount(void);
 uint64_t Timer_GetTime(void);
 uint32_t Timer_GetTimeint32(void);
 uint64_t Timer_GetTimeMS(void);
+void Timer_ResetCounter(void);
 void Timer_Reset(void);
 void Timer_CalcDT();
 int Timer_GetDT();
@@ -43,4 +44,21 @@ void StageTimer_Draw();
 void Timer_StartProfile(void);
 int Timer_EndProfile(void);
 
+//Per-section profiling, only the PC backend measures these
+typedef enum
+{
+    ProfileSection_ProcessPlayer,
+    ProfileSection_DrawNotes,
+    ProfileSection_ObjectList,
+    ProfileSection_Max,
+} ProfileSection;
+
+#ifdef PSXF_PC
+    void Timer_StartProfileSection(ProfileSection section);
+    void Timer_EndProfileSection(ProfileSection section);
+#else
+    #define Timer_StartProfileSection(section)
+    #define Timer_EndProfileSection(section)
+#endif
+
 #endif
@@ -0,0 +1,43 @@
+/*
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef PSXF_GUARD_VAG_H
+#define PSXF_GUARD_VAG_H
+
+#include <stdint.h>
+
+//.VAG header written by funkinvagpak, shared by the PSX and PC audio backends
+typedef struct {
+    uint32_t magic;         // 0x00: 0x69474156 ("VAGi") for interleaved files
+    uint32_t version;       // 0x04
+    uint32_t interleave;    // 0x08: Little-endian, size of each channel buffer
+    uint32_t size;          // 0x0C: Big-endian, in bytes
+    uint32_t sample_rate;   // 0x10: Big-endian, in Hertz
+    uint16_t flags;         // 0x14: Little-endian, VAG_FLAG_*
+    uint16_t _reserved[4];  // 0x16
+    uint16_t channels;      // 0x1E: Little-endian, channel count (stereo if 0)
+    char     name[16];      // 0x20
+    uint16_t gain[24];      // 0x30: Little-endian, 4.12 fixed point volume of each channel (if VAG_FLAG_GAIN)
+    uint16_t pitch[24];     // 0x60: Little-endian, 4.12 fixed point sample rate of each channel relative to sample_rate (if VAG_FLAG_PITCH)
+    uint8_t  role[24];      // 0x90: AudioRole (low nibble) and VAG_PAN_* (high nibble) of each channel (if VAG_FLAG_ROLE)
+} VAG_Header;
+
+#define VAG_FLAG_GAIN  (1 << 0)
+#define VAG_FLAG_PITCH (1 << 1)
+#define VAG_FLAG_ROLE  (1 << 2)
+
+#define VAG_PAN_LEFT   0
+#define VAG_PAN_RIGHT  1
+#define VAG_PAN_CENTER 2
+
+#define SWAP_ENDIAN(x) ( \
+    (((uint32_t) (x) & 0x000000ff) << 24) | \
+    (((uint32_t) (x) & 0x0000ff00) <<  8) | \
+    (((uint32_t) (x) & 0x00ff0000) >>  8) | \
+    (((uint32_t) (x) & 0xff000000) >> 24) \
+)
+
+#endif
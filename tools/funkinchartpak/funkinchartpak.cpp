@@ -5,21 +5,68 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <vector>
 #include <cstdint>
 #include <algorithm>
 #include <unordered_set>
+#include <filesystem>
+#include <thread>
+#include <atomic>
+#include <iomanip>
+#include <numeric>
+#include <stdexcept>
+#include <cmath>
 
 #include "json.hpp"
 using json = nlohmann::json;
 
+#define CHART_MAGIC   "FCHT"
+#define CHART_VERSION 2
+
+#define CHART_FLAG_MINES (1 << 0) //Chart has mine notes
+
+#define CHART_HEADER_SIZE 60
+
 #define SECTION_FLAG_OPPFOCUS (1 << 15) //Focus on opponent
 #define SECTION_FLAG_BPM_MASK 0x7FFF //1/24
 
+//Exact time in seconds, kept as a fraction so BPM changes don't accumulate rounding errors
+struct Rational
+{
+	int64_t num = 0, den = 1;
+};
+
+Rational MakeRational(int64_t num, int64_t den)
+{
+	int64_t gcd = std::gcd(num, den);
+	return {num / gcd, den / gcd};
+}
+
+Rational operator+(const Rational &a, const Rational &b)
+{
+	int64_t gcd = std::gcd(a.den, b.den);
+	if ((long double)a.den * (b.den / gcd) > 9e18L || std::fabs((long double)a.num * (b.den / gcd)) + std::fabs((long double)b.num * (a.den / gcd)) > 9e18L)
+		throw std::overflow_error("too many BPM changes for exact timing");
+	return MakeRational(a.num * (b.den / gcd) + b.num * (a.den / gcd), a.den * (b.den / gcd));
+}
+
+double ToDouble(const Rational &a)
+{
+	return (double)a.num / a.den;
+}
+
+//Length of 1/12 steps at the given BPM (1/24), 15 / 12 / (bpm / 24) seconds each
+Rational StepTime(int64_t length, uint16_t bpm)
+{
+	return MakeRational(length * 30, bpm);
+}
+
 struct Section
 {
 	uint16_t end;
 	uint16_t flag = 0;
+	Rational start; //When the section starts
 };
 
 #define NOTE_FLAG_OPPONENT    (1 << 2) //Note is opponent's
@@ -29,17 +76,81 @@ struct Section
 #define NOTE_FLAG_MINE        (1 << 6) //Note is a mine
 #define NOTE_FLAG_HIT         (1 << 7) //Note has been hit
 
+#define NOTE_LANES 8 //4 for each player, indexed by type & (NOTE_FLAG_OPPONENT | 3)
+
 struct Note
 {
 	uint16_t pos; //1/12 steps
 	uint8_t type, pad = 0;
 };
 
+struct Sustain
+{
+	uint16_t pos;    //First piece, 1/12 steps
+	uint16_t length; //Pieces, one per step
+	uint8_t type;
+};
+
 typedef int32_t fixed_t;
 
 #define FIXED_SHIFT (10)
 #define FIXED_UNIT  (1 << FIXED_SHIFT)
 
+#define FIXED_DEC(d, f) ((fixed_t)(((int64_t)(d) * FIXED_UNIT) / (f)))
+#define FIXED_MUL(x, y) ((fixed_t)(((int64_t)(x) * (y)) >> FIXED_SHIFT))
+
+fixed_t ToFixed(const Rational &a)
+{
+	//Round to the nearest 1/1024 second, times are never negative
+	int64_t rem = a.num % a.den;
+	return (fixed_t)((a.num / a.den) * FIXED_UNIT + (rem * FIXED_UNIT * 2 + a.den) / (a.den * 2));
+}
+
+struct NoteScroll
+{
+	fixed_t time; //Seconds from the start of the song
+	fixed_t size; //Note height
+};
+
+struct SustainScroll
+{
+	fixed_t time, end; //Seconds from the start of the song to the first and last piece
+	fixed_t size;      //Piece height
+};
+
+struct SectionCursor
+{
+	size_t i = 0;            //Section of the last position looked up
+	uint16_t start_step = 0; //Step that section starts at
+};
+
+NoteScroll GetNoteScroll(const std::vector<Section> &sections, SectionCursor &cursor, uint16_t pos, fixed_t speed)
+{
+	//Find the section containing the position, carrying on from the last one as
+	//positions are looked up in order (sustain ends can step back a little)
+	while (cursor.i != 0 && pos < cursor.start_step)
+	{
+		cursor.i--;
+		cursor.start_step = (cursor.i != 0) ? sections[cursor.i - 1].end : 0;
+	}
+	while (pos >= sections[cursor.i].end && (cursor.i + 1) != sections.size())
+		cursor.start_step = sections[cursor.i++].end;
+	
+	uint16_t start_step = cursor.start_step;
+	const Section &section = sections[cursor.i];
+	uint16_t bpm = section.flag & SECTION_FLAG_BPM_MASK;
+	uint16_t length_step = section.end - start_step;
+	fixed_t length = (fixed_t)(((int64_t)length_step * FIXED_DEC(15,1) / 12) * 24 / bpm);
+	
+	NoteScroll note_scroll;
+	if (pos == 0xFFFF)
+		note_scroll.time = ToFixed(section.start); //Dummy note, never drawn
+	else
+		note_scroll.time = ToFixed(section.start + StepTime(pos - start_step, bpm));
+	note_scroll.size = FIXED_MUL(speed, (int64_t)length * (12 * 150) / length_step) + FIXED_UNIT;
+	return note_scroll;
+}
+
 uint16_t PosRound(double pos, double crochet)
 {
 	return (uint16_t)std::floor(pos / crochet + 0.5);
@@ -59,85 +170,392 @@ void WriteLong(std::ostream &out, uint32_t word)
 	out.put(word >> 24);
 }
 
-int main(int argc, char *argv[])
+uint32_t CRC32(const std::string &data)
 {
-	if (argc < 3)
+	uint32_t crc = 0xFFFFFFFF;
+	for (unsigned char c : data)
 	{
-		std::cout << "usage: funkinchtpak out_json in_json" << std::endl;
-		return 0;
+		crc ^= c;
+		for (int i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
 	}
+	return ~crc;
+}
+
+//Chart json reader, picks what we need out of the parse events without building the whole document
+struct JsonNote
+{
+	double time = 0, sustain = 0; //Milliseconds
+	int64_t type = 0;
+	bool alt = false;
+};
+
+struct JsonSection
+{
+	bool must_hit = false, change_bpm = false, alt = false;
+	double bpm = 0;
+	std::vector<JsonNote> notes;
+};
+
+struct JsonSong
+{
+	double bpm = 0, speed = 0;
+	bool has_bpm = false, has_speed = false;
+	std::vector<JsonSection> sections;
+};
+
+class ChartReader : public nlohmann::json_sax<json>
+{
+	private:
+		struct Level
+		{
+			bool array;
+			size_t index = 0;
+			std::string key;
+		};
+		std::vector<Level> levels;
+		
+		//Where we are in the document, levels are song/notes/section/sectionNotes/note
+		bool InSong() const { return levels.size() >= 2 && levels[0].key == "song"; }
+		bool InSections() const { return levels.size() >= 3 && InSong() && levels[1].key == "notes" && levels[2].array; }
+		bool InSection() const { return levels.size() == 4 && InSections() && !levels[3].array; }
+		bool InSectionNotes() const { return levels.size() >= 5 && InSections() && levels[3].key == "sectionNotes" && levels[4].array; }
+		bool InNote() const { return levels.size() == 6 && InSectionNotes() && levels[5].array; }
+		
+		void Next()
+		{
+			if (!levels.empty() && levels.back().array)
+				levels.back().index++;
+		}
+		
+		bool Number(double value, int64_t integer)
+		{
+			if (levels.size() == 2 && InSong() && levels[1].key == "bpm")
+			{
+				song.bpm = value;
+				song.has_bpm = true;
+			}
+			else if (levels.size() == 2 && InSong() && levels[1].key == "speed")
+			{
+				song.speed = value;
+				song.has_speed = true;
+			}
+			else if (InSection() && levels[3].key == "bpm")
+			{
+				song.sections.back().bpm = value;
+			}
+			else if (InNote())
+			{
+				JsonNote &note = song.sections.back().notes.back();
+				switch (levels[5].index)
+				{
+					case 0:
+						note.time = value;
+						break;
+					case 1:
+						note.type = integer;
+						break;
+					case 2:
+						note.sustain = value;
+						break;
+				}
+			}
+			Next();
+			return true;
+		}
+		
+	public:
+		JsonSong song;
+		std::string error;
+		
+		bool null() override { Next(); return true; }
+		bool boolean(bool val) override
+		{
+			if (val && InSection())
+			{
+				JsonSection &section = song.sections.back();
+				if (levels[3].key == "mustHitSection")
+					section.must_hit = true;
+				else if (levels[3].key == "changeBPM")
+					section.change_bpm = true;
+				else if (levels[3].key == "altAnim")
+					section.alt = true;
+			}
+			else if (val && InNote() && levels[5].index == 3)
+			{
+				song.sections.back().notes.back().alt = true;
+			}
+			Next();
+			return true;
+		}
+		bool number_integer(number_integer_t val) override { return Number((double)val, val); }
+		bool number_unsigned(number_unsigned_t val) override { return Number((double)val, (int64_t)val); }
+		bool number_float(number_float_t val, const string_t &) override { return Number(val, (int64_t)val); }
+		bool string(string_t &) override { Next(); return true; }
+		bool binary(binary_t &) override { Next(); return true; }
+		
+		bool start_object(std::size_t) override
+		{
+			if (levels.size() == 3 && InSections())
+				song.sections.emplace_back();
+			levels.push_back({false});
+			return true;
+		}
+		bool key(string_t &val) override
+		{
+			levels.back().key = val;
+			return true;
+		}
+		bool end_object() override
+		{
+			levels.pop_back();
+			Next();
+			return true;
+		}
+		
+		bool start_array(std::size_t) override
+		{
+			if (levels.size() == 5 && InSectionNotes())
+				song.sections.back().notes.emplace_back();
+			levels.push_back({true});
+			return true;
+		}
+		bool end_array() override
+		{
+			levels.pop_back();
+			Next();
+			return true;
+		}
+		
+		bool parse_error(std::size_t, const std::string &, const nlohmann::detail::exception &ex) override
+		{
+			error = ex.what();
+			return false;
+		}
+};
+
+//Stage_DrawNotes culling, in pixels on a 240 line screen
+#define STATS_FPS         60
+#define STATS_NOTE_Y      (32 - 120 + 5) //Strum line
+#define STATS_SCREEN_TOP  (-16 - 120)    //Notes are culled above this
+#define STATS_SCREEN_BOT  (240 / 2)      //And below this
+#define STATS_POLY_FT4    40             //sizeof(POLY_FT4)
+#define STATS_PRIBUFF     32768          //Size of one primitive buffer
+
+std::string FormatTime(fixed_t time)
+{
+	int seconds = time >> FIXED_SHIFT;
+	std::ostringstream out;
+	out << (seconds / 60) << ':' << std::setw(2) << std::setfill('0') << (seconds % 60);
+	return out.str();
+}
+
+void PrintStats(const std::vector<Note> &notes, const std::vector<NoteScroll> &note_scrolls, const std::vector<Sustain> &sustains, const std::vector<SustainScroll> &sustain_scrolls, fixed_t speed, std::ostream &log)
+{
+	//Notes and sustains end with a dummy
+	size_t num_notes = notes.size() - 1, num_sustains = sustains.size() - 1;
 	
+	//Count notes
+	size_t player_notes = 0, opponent_notes = 0, mines = 0, pieces = 0;
+	fixed_t end = 0;
+	for (size_t i = 0; i < num_notes; i++)
+	{
+		if (notes[i].type & NOTE_FLAG_MINE)
+			mines++;
+		else if (notes[i].type & NOTE_FLAG_OPPONENT)
+			opponent_notes++;
+		else
+			player_notes++;
+		end = std::max(end, note_scrolls[i].time);
+	}
+	for (size_t i = 0; i < num_sustains; i++)
+	{
+		pieces += sustains[i].length;
+		end = std::max(end, sustain_scrolls[i].end);
+	}
+	log << "stats: " << FormatTime(end) << " long, " << player_notes << " player notes, " << opponent_notes << " opponent notes, " << mines << " mines, " << num_sustains << " sustains with " << pieces << " pieces" << std::endl;
+	
+	//Notes per second, not counting mines
+	std::vector<int> nps[2];
+	nps[0].resize((end >> FIXED_SHIFT) + 1);
+	nps[1].resize((end >> FIXED_SHIFT) + 1);
+	for (size_t i = 0; i < num_notes; i++)
+		if (!(notes[i].type & NOTE_FLAG_MINE))
+			nps[(notes[i].type & NOTE_FLAG_OPPONENT) != 0][note_scrolls[i].time >> FIXED_SHIFT]++;
+	
+	for (int i = 0; i < 2; i++)
+	{
+		auto peak = std::max_element(nps[i].begin(), nps[i].end());
+		log << (i ? "opponent" : "player") << " nps: peak " << *peak << " at " << FormatTime((fixed_t)(peak - nps[i].begin()) << FIXED_SHIFT) << ", mean " << std::setprecision(3) << (double)(i ? opponent_notes : player_notes) * FIXED_UNIT / std::max(end, FIXED_UNIT) << std::endl;
+		log << (i ? "opponent" : "player") << " nps timeline:";
+		for (size_t j = 0; j < nps[i].size(); j++)
+			log << ((j % 30) ? " " : "\n  " + FormatTime((fixed_t)j << FIXED_SHIFT) + "  ") << nps[i][j];
+		log << std::endl;
+	}
+	
+	//Step through the song a frame at a time, assuming nothing gets hit (hit notes aren't drawn)
+	size_t peak_notes = 0, peak_sustains = 0, peak_prims = 0;
+	fixed_t peak_notes_time = 0, peak_prims_time = 0;
+	size_t first_note = 0, first_sustain = 0;
+	for (int64_t frame = 0;; frame++)
+	{
+		fixed_t song_time = (fixed_t)(frame * FIXED_UNIT / STATS_FPS);
+		if (song_time > end + FIXED_UNIT)
+			break;
+		
+		//Notes, mines are drawn with their fire
+		size_t visible_notes = 0, prims = 0;
+		for (size_t i = first_note; i < num_notes; i++)
+		{
+			fixed_t y = FIXED_DEC(STATS_NOTE_Y,1) + FIXED_MUL(speed, (note_scrolls[i].time - song_time) * 150);
+			if (y < FIXED_DEC(STATS_SCREEN_TOP,1))
+			{
+				if (i == first_note)
+					first_note++;
+				continue;
+			}
+			if (y > FIXED_DEC(STATS_SCREEN_BOT,1) + note_scrolls[i].size)
+				break;
+			visible_notes++;
+			prims += (notes[i].type & NOTE_FLAG_MINE) ? 2 : 1;
+		}
+		
+		//Sustains, drawn as a body and an end
+		size_t visible_sustains = 0;
+		for (size_t i = first_sustain; i < num_sustains; i++)
+		{
+			const SustainScroll &scroll = sustain_scrolls[i];
+			fixed_t y = FIXED_DEC(STATS_NOTE_Y,1) + FIXED_MUL(speed, (scroll.time - song_time) * 150) - scroll.size;
+			fixed_t end_y = FIXED_DEC(STATS_NOTE_Y,1) + FIXED_MUL(speed, (scroll.end - song_time) * 150) - scroll.size;
+			if (end_y + scroll.size < FIXED_DEC(STATS_SCREEN_TOP,1))
+			{
+				if (i == first_sustain)
+					first_sustain++;
+				continue;
+			}
+			if (y > FIXED_DEC(STATS_SCREEN_BOT,1))
+				break;
+			visible_sustains++;
+			prims += 2;
+		}
+		
+		if (visible_notes > peak_notes)
+		{
+			peak_notes = visible_notes;
+			peak_notes_time = song_time;
+		}
+		peak_sustains = std::max(peak_sustains, visible_sustains);
+		if (prims > peak_prims)
+		{
+			peak_prims = prims;
+			peak_prims_time = song_time;
+		}
+	}
+	
+	size_t peak_bytes = peak_prims * STATS_POLY_FT4;
+	log << "visible: peak " << peak_notes << " notes at " << FormatTime(peak_notes_time) << ", peak " << peak_sustains << " sustains" << std::endl;
+	log << "prims: peak " << peak_prims << " POLY_FT4 for notes at " << FormatTime(peak_prims_time) << ", " << peak_bytes << " of " << STATS_PRIBUFF << " pribuff bytes (" << (peak_bytes * 100 / STATS_PRIBUFF) << "%)" << std::endl;
+	if (peak_bytes >= STATS_PRIBUFF)
+		log << "WARNING: notes alone overflow the pribuff" << std::endl;
+}
+
+bool PackChartJson(const std::string &in_path, std::string &chart, std::ostream &log, bool stats)
+{
 	//Read json
-	std::ifstream i(argv[2]);
+	std::ifstream i(in_path);
 	if (!i.is_open())
 	{
-		std::cout << "Failed to open " << argv[2] << std::endl;
-		return 1;
+		log << "Failed to open " << in_path << std::endl;
+		return false;
+	}
+	ChartReader reader;
+	if (!json::sax_parse(i, &reader))
+	{
+		log << "Failed to parse " << in_path << ": " << reader.error << std::endl;
+		return false;
+	}
+	if (!reader.song.has_bpm || !reader.song.has_speed)
+	{
+		log << in_path << " is missing the song's bpm or speed" << std::endl;
+		return false;
 	}
-	json j;
-	i >> j;
-	
-	auto song_info = j["song"];
 	
-	double bpm = song_info["bpm"];
-	double crochet = (60.0 / bpm) * 1000.0;
-	double step_crochet = crochet / 4;
+	//Work in the same 1/24 BPM the game uses, so note positions line up with its timing
+	double bpm = reader.song.bpm;
+	uint16_t bpm_24 = PosRound(bpm, 1.0 / 24.0) & SECTION_FLAG_BPM_MASK;
+	if (bpm_24 == 0)
+	{
+		log << in_path << " has no bpm" << std::endl;
+		return false;
+	}
+	double step_crochet = 360000.0 / bpm_24;
 	
-	double speed = song_info["speed"];
+	double speed = reader.song.speed;
 	
-	std::cout << argv[2] << " speed: " << speed << " ini bpm: " << bpm << " step_crochet: " << step_crochet << std::endl;
+	log << in_path << " speed: " << speed << " ini bpm: " << bpm << " step_crochet: " << step_crochet << std::endl;
 	
-	double milli_base = 0;
+	Rational section_start, time_base;
 	uint16_t step_base = 0;
 	
 	std::vector<Section> sections;
 	std::vector<Note> notes;
+	std::vector<Sustain> sustains;
 	
 	uint16_t section_end = 0;
 	int score = 0, dups = 0;
+	int32_t max_score[2] = {0, 0};
+	uint16_t flags = 0;
 	std::unordered_set<uint32_t> note_fudge;
-	for (auto &i : song_info["notes"]) //Iterate through sections
+	for (auto &i : reader.song.sections) //Iterate through sections
 	{
-		bool is_opponent = i["mustHitSection"] != true; //Note: swapped
+		bool is_opponent = !i.must_hit; //Note: swapped
 		
 		//Read section
 		Section new_section;
-		if (i["changeBPM"] == true)
+		if (i.change_bpm)
 		{
 			//Update BPM (THIS IS HELL!)
-			milli_base += step_crochet * (section_end - step_base);
+			time_base = section_start;
 			step_base = section_end;
 			
-			bpm = i["bpm"];
-			crochet = (60.0 / bpm) * 1000.0;
-			step_crochet = crochet / 4;
+			bpm = i.bpm;
+			bpm_24 = PosRound(bpm, 1.0 / 24.0) & SECTION_FLAG_BPM_MASK;
+			if (bpm_24 == 0)
+			{
+				log << in_path << " changes to an invalid bpm" << std::endl;
+				return false;
+			}
+			step_crochet = 360000.0 / bpm_24;
 			
-			std::cout << "chg bpm: " << bpm << " step_crochet: " << step_crochet << " milli_base: " << milli_base << " step_base: " << step_base << std::endl;
+			log << "chg bpm: " << bpm << " step_crochet: " << step_crochet << " milli_base: " << ToDouble(time_base) * 1000.0 << " step_base: " << step_base << std::endl;
 		}
 		new_section.end = (section_end += 16) * 12; //(uint16_t)i["lengthInSteps"]) * 12; //I had to do this for compatibility
-		new_section.flag = PosRound(bpm, 1.0 / 24.0) & SECTION_FLAG_BPM_MASK; 
-		bool is_alt = i["altAnim"] == true;
+		new_section.flag = bpm_24; 
+		new_section.start = section_start;
+		bool is_alt = i.alt;
 		if (is_opponent)
 			new_section.flag |= SECTION_FLAG_OPPFOCUS;
 		sections.push_back(new_section);
+		section_start = section_start + StepTime(16 * 12, bpm_24);
+		double milli_base = ToDouble(time_base) * 1000.0;
 		
 		//Read notes
-		for (auto &j : i["sectionNotes"])
+		for (auto &j : i.notes)
 		{
 			//Push main note
 			Note new_note;
-			int sustain = (int)PosRound(j[2], step_crochet) - 1;
-			new_note.pos = (step_base * 12) + PosRound(((double)j[0] - milli_base) * 12.0, step_crochet);
-			new_note.type = (uint8_t)j[1] & (3 | NOTE_FLAG_OPPONENT);
+			int sustain = (int)PosRound(j.sustain, step_crochet) - 1;
+			new_note.pos = (step_base * 12) + PosRound((j.time - milli_base) * 12.0, step_crochet);
+			new_note.type = (uint8_t)j.type & (3 | NOTE_FLAG_OPPONENT);
 			if (is_opponent)
 				new_note.type ^= NOTE_FLAG_OPPONENT;
-			if (j[3] == true)
+			if (j.alt)
 				new_note.type |= NOTE_FLAG_ALT_ANIM;
 			else if ((new_note.type & NOTE_FLAG_OPPONENT) && is_alt)
 				new_note.type |= NOTE_FLAG_ALT_ANIM;
 			if (sustain >= 0)
 				new_note.type |= NOTE_FLAG_SUSTAIN_END;
-			if (((uint8_t)j[1]) & 8)
+			if (((uint8_t)j.type) & 8)
 				new_note.type |= NOTE_FLAG_MINE;
 			
 			if (note_fudge.count(*((uint32_t*)&new_note)))
@@ -150,33 +568,37 @@ int main(int argc, char *argv[])
 			notes.push_back(new_note);
 			if (!(new_note.type & NOTE_FLAG_OPPONENT))
 				score += 350;
+			if (new_note.type & NOTE_FLAG_MINE)
+				flags |= CHART_FLAG_MINES;
+			else
+				max_score[(new_note.type & NOTE_FLAG_OPPONENT) != 0] += 35;
 			
-			//Push sustain notes
-			for (int k = 0; k <= sustain; k++)
+			//Push sustain, one piece every step after the note
+			if (sustain >= 0)
 			{
-				Note sus_note; //jerma
-				sus_note.pos = new_note.pos + ((k + 1) * 12);
-				sus_note.type = new_note.type | NOTE_FLAG_SUSTAIN;
-				if (k != sustain)
-					sus_note.type &= ~NOTE_FLAG_SUSTAIN_END;
-				notes.push_back(sus_note);
+				Sustain sus_note; //jerma
+				sus_note.pos = new_note.pos + 12;
+				sus_note.length = sustain + 1;
+				sus_note.type = (new_note.type & ~NOTE_FLAG_SUSTAIN_END) | NOTE_FLAG_SUSTAIN;
+				sustains.push_back(sus_note);
 			}
 		}
 	}
-	std::cout << "max score: " << score << " dups excluded: " << dups << std::endl;
+	log << "max score: " << score << " dups excluded: " << dups << std::endl;
 	
 	//Sort notes
-	std::sort(notes.begin(), notes.end(), [](Note a, Note b) {
-		if (a.pos == b.pos)
-			return (b.type & NOTE_FLAG_SUSTAIN) && !(a.type & NOTE_FLAG_SUSTAIN);
-		else
-			return a.pos < b.pos;
+	std::stable_sort(notes.begin(), notes.end(), [](Note a, Note b) {
+		return a.pos < b.pos;
+	});
+	std::stable_sort(sustains.begin(), sustains.end(), [](Sustain a, Sustain b) {
+		return a.pos < b.pos;
 	});
 	
 	//Push dummy section and note
 	Section dum_section;
 	dum_section.end = 0xFFFF;
 	dum_section.flag = sections[sections.size() - 1].flag;
+	dum_section.start = section_start;
 	sections.push_back(dum_section);
 	
 	Note dum_note;
@@ -184,31 +606,244 @@ int main(int argc, char *argv[])
 	dum_note.type = NOTE_FLAG_HIT;
 	notes.push_back(dum_note);
 	
-	//Write to output
-	std::ofstream out(std::string(argv[1]), std::ostream::binary);
-	if (!out.is_open())
+	Sustain dum_sustain;
+	dum_sustain.pos = 0xFFFF;
+	dum_sustain.length = 0;
+	dum_sustain.type = NOTE_FLAG_HIT;
+	sustains.push_back(dum_sustain);
+	
+	//Precompute note times so the game doesn't have to walk sections every frame
+	fixed_t speed_fixed = (fixed_t)(speed * FIXED_UNIT);
+	
+	std::vector<NoteScroll> note_scrolls;
+	SectionCursor note_cursor;
+	for (auto &i : notes)
+		note_scrolls.push_back(GetNoteScroll(sections, note_cursor, i.pos, speed_fixed));
+	
+	std::vector<SustainScroll> sustain_scrolls;
+	SectionCursor start_cursor, end_cursor;
+	for (auto &i : sustains)
 	{
-		std::cout << "Failed to open " << argv[1] << ".cht" << std::endl;
-		return 1;
+		NoteScroll start = GetNoteScroll(sections, start_cursor, i.pos, speed_fixed);
+		NoteScroll end = (i.length != 0) ? GetNoteScroll(sections, end_cursor, i.pos + (i.length - 1) * 12, speed_fixed) : start;
+		
+		SustainScroll sustain_scroll;
+		sustain_scroll.time = start.time;
+		sustain_scroll.end = end.time;
+		sustain_scroll.size = end.size;
+		sustain_scrolls.push_back(sustain_scroll);
+	}
+	
+	if (stats)
+		PrintStats(notes, note_scrolls, sustains, sustain_scrolls, speed_fixed, log);
+	
+	//Split note indices by lane so hit detection only looks at its own lane
+	if (notes.size() > 0xFFFF)
+	{
+		log << in_path << " has too many notes (" << notes.size() << ")" << std::endl;
+		return false;
 	}
 	
-	//Write header
-	WriteLong(out, (fixed_t)(speed * FIXED_UNIT));
-	WriteWord(out, 6 + (sections.size() << 2));
+	std::vector<uint16_t> lanes[NOTE_LANES];
+	for (size_t i = 0; i < notes.size() - 1; i++)
+		lanes[notes[i].type & (NOTE_FLAG_OPPONENT | 3)].push_back(i);
+	for (auto &i : lanes)
+		i.push_back(notes.size() - 1); //Each lane ends with the dummy note
+	
+	//Write chart data, offsets are from the start of the file
+	std::ostringstream data;
 	
 	//Write sections
+	uint32_t section_offset = CHART_HEADER_SIZE + data.tellp();
 	for (auto &i : sections)
 	{
-		WriteWord(out, i.end);
-		WriteWord(out, i.flag);
+		WriteWord(data, i.end);
+		WriteWord(data, i.flag);
+		WriteLong(data, ToFixed(i.start));
 	}
 	
 	//Write notes
+	uint32_t note_offset = CHART_HEADER_SIZE + data.tellp();
 	for (auto &i : notes)
 	{
-		WriteWord(out, i.pos);
-		out.put(i.type);
-		out.put(0);
+		WriteWord(data, i.pos);
+		data.put(i.type);
+		data.put(0);
+	}
+	
+	//Write note scroll table, aligned to 4 bytes after the notes (always the case, notes are 4 bytes)
+	uint32_t note_scroll_offset = CHART_HEADER_SIZE + data.tellp();
+	for (auto &i : note_scrolls)
+	{
+		WriteLong(data, i.time);
+		WriteLong(data, i.size);
+	}
+	
+	//Write lane table, start of each lane followed by the note indices
+	uint32_t lane_offset = CHART_HEADER_SIZE + data.tellp();
+	uint16_t lane_start = 0;
+	for (auto &i : lanes)
+	{
+		WriteWord(data, lane_start);
+		lane_start += i.size();
+	}
+	for (auto &i : lanes)
+		for (auto &j : i)
+			WriteWord(data, j);
+	
+	//Write sustains and their scroll table, aligned to 4 bytes after the lane table
+	for (size_t lane_end = NOTE_LANES + lane_start; lane_end & 1; lane_end++)
+		WriteWord(data, 0);
+	uint32_t sustain_offset = CHART_HEADER_SIZE + data.tellp();
+	for (auto &i : sustains)
+	{
+		WriteWord(data, i.pos);
+		WriteWord(data, i.length);
+		WriteWord(data, i.type);
+		WriteWord(data, 0); //Pieces done, used by the game
+	}
+	uint32_t sustain_scroll_offset = CHART_HEADER_SIZE + data.tellp();
+	for (auto &i : sustain_scrolls)
+	{
+		WriteLong(data, i.time);
+		WriteLong(data, i.end);
+		WriteLong(data, i.size);
+	}
+	
+	//Write header, counts don't include the dummy section, note and sustain
+	std::string data_str = data.str();
+	std::ostringstream out;
+	out.write(CHART_MAGIC, 4);
+	WriteWord(out, CHART_VERSION);
+	WriteWord(out, flags);
+	WriteLong(out, data_str.size());
+	WriteLong(out, CRC32(data_str));
+	WriteLong(out, speed_fixed);
+	WriteWord(out, sections.size() - 1);
+	WriteWord(out, notes.size() - 1);
+	WriteWord(out, sustains.size() - 1);
+	WriteWord(out, 0);
+	WriteLong(out, max_score[0]);
+	WriteLong(out, max_score[1]);
+	WriteLong(out, section_offset);
+	WriteLong(out, note_offset);
+	WriteLong(out, note_scroll_offset);
+	WriteLong(out, lane_offset);
+	WriteLong(out, sustain_offset);
+	WriteLong(out, sustain_scroll_offset);
+	
+	//Write data
+	out.write(data_str.data(), data_str.size());
+	chart = out.str();
+	return true;
+}
+
+bool PackChart(const std::string &in_path, std::string &chart, std::ostream &log, bool stats = false)
+{
+	try
+	{
+		return PackChartJson(in_path, chart, log, stats);
+	}
+	catch (std::overflow_error &e)
+	{
+		log << in_path << ": " << e.what() << std::endl;
+		return false;
+	}
+}
+
+bool WriteChart(const std::string &out_path, const std::string &chart, std::ostream &log)
+{
+	//Leave the output alone if its contents wouldn't change, so nothing depending on it rebuilds
+	std::ifstream old(out_path, std::istream::binary);
+	if (old.is_open())
+	{
+		std::ostringstream old_chart;
+		old_chart << old.rdbuf();
+		if (old_chart.str() == chart)
+		{
+			log << out_path << " unchanged" << std::endl;
+			return true;
+		}
+	}
+	
+	std::ofstream out(out_path, std::ostream::binary);
+	if (!out.is_open())
+	{
+		log << "Failed to open " << out_path << std::endl;
+		return false;
+	}
+	out.write(chart.data(), chart.size());
+	return true;
+}
+
+bool ConvertChart(const std::string &out_path, const std::string &in_path, std::ostream &log)
+{
+	std::string chart;
+	return PackChart(in_path, chart, log) && WriteChart(out_path, chart, log);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 3)
+	{
+		std::cout << "usage: funkinchtpak out_cht in_json" << std::endl;
+		std::cout << "       funkinchtpak --batch out_dir in_json..." << std::endl;
+		std::cout << "       funkinchtpak --stats in_json..." << std::endl;
+		return 0;
+	}
+	
+	bool stats = std::string(argv[1]) == "--stats";
+	if (std::string(argv[1]) != "--batch" && !stats)
+		return ConvertChart(argv[1], argv[2], std::cout) ? 0 : 1;
+	
+	//Convert (or just profile) every chart in this process, spread over a thread per core
+	std::filesystem::path out_dir;
+	if (!stats)
+	{
+		out_dir = argv[2];
+		std::error_code error;
+		std::filesystem::create_directories(out_dir, error);
+	}
+	
+	std::vector<std::string> in_paths(argv + (stats ? 2 : 3), argv + argc);
+	std::vector<std::ostringstream> logs(in_paths.size());
+	std::vector<char> results(in_paths.size(), false);
+	
+	std::atomic<size_t> next_chart(0);
+	auto worker = [&]() {
+		for (size_t i; (i = next_chart++) < in_paths.size();)
+		{
+			if (stats)
+			{
+				std::string chart;
+				results[i] = PackChart(in_paths[i], chart, logs[i], true);
+				continue;
+			}
+			std::filesystem::path out_path = out_dir / std::filesystem::path(in_paths[i]).filename().replace_extension(".cht");
+			results[i] = ConvertChart(out_path.string(), in_paths[i], logs[i]);
+		}
+	};
+	
+	size_t num_threads = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), in_paths.size());
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < num_threads; i++)
+		threads.emplace_back(worker);
+	worker();
+	for (auto &i : threads)
+		i.join();
+	
+	//Print logs in order so they don't interleave
+	int failed = 0;
+	for (size_t i = 0; i < in_paths.size(); i++)
+	{
+		std::cout << logs[i].str();
+		if (!results[i])
+			failed++;
+	}
+	if (failed)
+	{
+		std::cout << failed << " of " << in_paths.size() << " charts failed" << std::endl;
+		return 1;
 	}
 	return 0;
 }
\ No newline at end of file
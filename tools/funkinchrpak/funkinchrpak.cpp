@@ -91,6 +91,146 @@ int getEnumFromString(std::vector<std::string> &compare, std::string str) {
     return 0;
 }
 
+//Character json reader, picks what we need out of the parse events without building the whole document
+struct JsonScriptValue
+{
+    bool is_string = false;
+    int64_t num = 0;
+    std::string str;
+};
+
+struct JsonFrame
+{
+    std::string tex;
+    int64_t src[4] = {0, 0, 0, 0};
+    int64_t off[2] = {0, 0};
+};
+
+struct JsonAnimation
+{
+    int64_t spd = 0;
+    std::vector<JsonScriptValue> script;
+};
+
+struct JsonCharacter
+{
+    bool spec_is_string = false;
+    std::string spec, health_bar, archive;
+    int64_t health_i = 0;
+    int64_t focus[3][2] = {{0, 0}, {0, 0}, {0, 0}};
+    int64_t scale[2] = {0, 0};
+    std::vector<std::string> structs, textures;
+    std::vector<JsonFrame> frames;
+    std::vector<JsonAnimation> animations;
+};
+
+class CharacterReader : public nlohmann::json_sax<json>
+{
+private:
+    struct Level
+    {
+        bool array;
+        size_t index = 0;
+        std::string key;
+    };
+    std::vector<Level> levels;
+
+    //levels[0] is the root object, its key is the field being read
+    bool In(const char *field, size_t depth) const { return levels.size() == depth && levels[0].key == field; }
+
+    void Next()
+    {
+        if (!levels.empty() && levels.back().array)
+            levels.back().index++;
+    }
+
+    bool Value(bool is_string, int64_t num, const std::string &str)
+    {
+        if (In("spec", 1))
+        {
+            character.spec_is_string = is_string;
+            character.spec = str;
+        }
+        else if (In("health_i", 1))
+            character.health_i = num;
+        else if (In("health_bar", 1))
+            character.health_bar = str;
+        else if (In("archive", 1))
+            character.archive = str;
+        else if (In("focus", 3) && levels[1].index < 3 && levels[2].index < 2)
+            character.focus[levels[1].index][levels[2].index] = num;
+        else if (In("scale", 2) && levels[1].index < 2)
+            character.scale[levels[1].index] = num;
+        else if (In("struct", 2))
+            character.structs.push_back(str);
+        else if (In("textures", 2))
+            character.textures.push_back(str);
+        else if (In("frames", 3) && levels[2].index == 0)
+            character.frames.back().tex = str;
+        else if (In("frames", 4) && levels[2].index == 1 && levels[3].index < 4)
+            character.frames.back().src[levels[3].index] = num;
+        else if (In("frames", 4) && levels[2].index == 2 && levels[3].index < 2)
+            character.frames.back().off[levels[3].index] = num;
+        else if (In("animation", 3) && levels[2].index == 0)
+            character.animations.back().spd = num;
+        else if (In("animation", 4) && levels[2].index == 1)
+            character.animations.back().script.push_back({is_string, num, str});
+        Next();
+        return true;
+    }
+
+public:
+    JsonCharacter character;
+    std::string error;
+
+    bool null() override { return Value(false, 0, ""); }
+    bool boolean(bool val) override { return Value(false, val, ""); }
+    bool number_integer(number_integer_t val) override { return Value(false, val, ""); }
+    bool number_unsigned(number_unsigned_t val) override { return Value(false, (int64_t)val, ""); }
+    bool number_float(number_float_t val, const string_t &) override { return Value(false, (int64_t)val, ""); }
+    bool string(string_t &val) override { return Value(true, 0, val); }
+    bool binary(binary_t &) override { return Value(false, 0, ""); }
+
+    bool start_object(std::size_t) override
+    {
+        levels.push_back({false});
+        return true;
+    }
+    bool key(string_t &val) override
+    {
+        levels.back().key = val;
+        return true;
+    }
+    bool end_object() override
+    {
+        levels.pop_back();
+        Next();
+        return true;
+    }
+
+    bool start_array(std::size_t) override
+    {
+        if (In("frames", 2))
+            character.frames.emplace_back();
+        else if (In("animation", 2))
+            character.animations.emplace_back();
+        levels.push_back({true});
+        return true;
+    }
+    bool end_array() override
+    {
+        levels.pop_back();
+        Next();
+        return true;
+    }
+
+    bool parse_error(std::size_t, const std::string &, const nlohmann::detail::exception &ex) override
+    {
+        error = ex.what();
+        return false;
+    }
+};
+
 int main(int argc, char *argv[])
 {
     if (argc < 3)
@@ -106,15 +246,20 @@ int main(int argc, char *argv[])
         std::cout << "Failed to open " << argv[2] << std::endl;
         return 1;
     }
-    json j;
-    file >> j;
+    CharacterReader reader;
+    if (!json::sax_parse(file, &reader))
+    {
+        std::cout << "Failed to parse " << argv[2] << ": " << reader.error << std::endl;
+        return 1;
+    }
+    JsonCharacter &j = reader.character;
 
-    CharacterFileHeader new_char;
+    CharacterFileHeader new_char = {};
 
-    bool isstr = j["spec"].is_string();
+    bool isstr = j.spec_is_string;
     if (isstr)
     {
-        std::string spec = j["spec"];
+        std::string spec = j.spec;
         if (spec == "CHAR_SPEC_MISSANIM")
             new_char.spec = CHAR_SPEC_MISSANIM;
         else if (spec == "CHAR_SPEC_SPOOKIDLE")
@@ -131,117 +276,97 @@ int main(int argc, char *argv[])
     }
     else new_char.spec = 0;
 
-    new_char.health_i = j["health_i"];
-    std::string health_bar_str = j["health_bar"];
-    new_char.health_bar = std::stoul(health_bar_str, nullptr, 16);
-    std::string arcpath = j["archive"];
-    strncpy(new_char.archive_path, arcpath.c_str(), sizeof(new_char.archive_path));
-    new_char.focus_x[0] = j["focus"][0][0];
-    new_char.focus_x[1] = j["focus"][0][1];
-    new_char.focus_y[0] = j["focus"][1][0];
-    new_char.focus_y[1] = j["focus"][1][1];
-    new_char.focus_zoom[0] = j["focus"][2][0];
-    new_char.focus_zoom[1] = j["focus"][2][1];
-    new_char.scale[0] = j["scale"][0];
-    new_char.scale[1] = j["scale"][1];
+    new_char.health_i = j.health_i;
+    new_char.health_bar = std::stoul(j.health_bar, nullptr, 16);
+    strncpy(new_char.archive_path, j.archive.c_str(), sizeof(new_char.archive_path));
+    new_char.focus_x[0] = j.focus[0][0];
+    new_char.focus_x[1] = j.focus[0][1];
+    new_char.focus_y[0] = j.focus[1][0];
+    new_char.focus_y[1] = j.focus[1][1];
+    new_char.focus_zoom[0] = j.focus[2][0];
+    new_char.focus_zoom[1] = j.focus[2][1];
+    new_char.scale[0] = j.scale[0];
+    new_char.scale[1] = j.scale[1];
 
     //parse animation
-    for (int i = 0; i < j["struct"].size(); i++) 
-        charStruct.push_back(j["struct"][i]);
+    charStruct = j.structs;
 
-    new_char.size_struct = j["struct"].size();
-    CharFrame frames[j["frames"].size()];
-    new_char.size_frames = j["frames"].size();
+    new_char.size_struct = j.structs.size();
+    CharFrame frames[j.frames.size()];
+    new_char.size_frames = j.frames.size();
     //parse frames
-    for (int i = 0; i < j["frames"].size(); i++) {
-        std::string texstr = j["frames"][i][0];
-        frames[i].tex = getEnumFromString(charStruct, j["frames"][i][0]);
+    for (int i = 0; i < j.frames.size(); i++) {
+        frames[i].tex = getEnumFromString(charStruct, j.frames[i].tex);
         for (int i2 = 0; i2 < 4; i2++)
-            frames[i].src[i2] = j["frames"][i][1][i2];
-        frames[i].off[0] = j["frames"][i][2][0];
-        frames[i].off[1] = j["frames"][i][2][1];
+            frames[i].src[i2] = j.frames[i].src[i2];
+        frames[i].off[0] = j.frames[i].off[0];
+        frames[i].off[1] = j.frames[i].off[1];
     }
 
-    Animation anims[j["animation"].size()];     
-    std::vector<std::vector<uint16_t>> scripts;
-    new_char.size_animation = j["animation"].size();
+    Animation anims[j.animations.size()];     
+    std::vector<std::vector<uint16_t>> scripts(j.animations.size());
+    new_char.size_animation = j.animations.size();
 
-    for (int i = 0; i < j["animation"].size(); i++) {
-    //    std::cout << "loopy" << std::endl;
-        scripts.resize(j["animation"].size());
-        scripts[i].resize(j["animation"][i][1].size());
-        new_char.sizes_scripts[i] = j["animation"][i][1].size();
+    for (int i = 0; i < j.animations.size(); i++) {
+        std::vector<JsonScriptValue> &script = j.animations[i].script;
+        scripts[i].resize(script.size());
+        new_char.sizes_scripts[i] = script.size();
 
-        anims[i].spd = j["animation"][i][0];
+        anims[i].spd = j.animations[i].spd;
 
-        for (int i2 = 0; i2 < j["animation"][i][1].size(); i2++) {
-            if (i2 < j["animation"][i][1].size()-2)
-            {
-             //   std::cout << j["animation"][i][1][i2] << std::endl;
-                scripts[i][i2] = j["animation"][i][1][i2];
-            }
+        for (int i2 = 0; i2 < script.size(); i2++) {
+            if (i2 < script.size()-2)
+                scripts[i][i2] = script[i2].num;
             else //change string to number
             {
-                if (i2 == j["animation"][i][1].size()-2) { // ascr mode
-                  //  std::cout << "ascr " << j["animation"][i][1][i2] << std::endl;
-                    bool isstr = j["animation"][i][1][i2].is_string();
+                if (i2 == script.size()-2) { // ascr mode
                     std::string ascrmode;
-                    if (!isstr && j["animation"][i][1][i2+1] == "ASCR_REPEAT")
+                    if (!script[i2].is_string && script[i2+1].str == "ASCR_REPEAT")
                     {
-                        ascrmode = j["animation"][i][1][i2+1];
-                     //   std::cout << "ascr real " << j["animation"][i][1][i2+1] << std::endl;
-                        scripts[i][i2] = j["animation"][i][1][i2];
+                        scripts[i][i2] = script[i2].num;
                         scripts[i][i2+1] = ASCR_REPEAT;
                         break;
                     }
-                    else {
-                        ascrmode = j["animation"][i][1][i2];
-                  //      std::cout << "ascr real " << j["animation"][i][1][i2] << std::endl;
-                    }
+                    else
+                        ascrmode = script[i2].str;
 
                     if (ascrmode == "ASCR_BACK")
                         scripts[i][i2] = ASCR_BACK;
                     else if (ascrmode == "ASCR_CHGANI")
                         scripts[i][i2] = ASCR_CHGANI;
                 }
-                if (i2 == j["animation"][i][1].size()-1) // back animation
+                if (i2 == script.size()-1) // back animation
                 {
-                    bool isstring = j["animation"][i][1][i2].is_string();
-                    if (isstring) {
-                        std::string backanim = j["animation"][i][1][i2];
+                    if (script[i2].is_string) {
+                        std::string &backanim = script[i2].str;
                         if (i > charAnim.size() && !std::count(charAnim.begin(), charAnim.end(), backanim))
                             scripts[i][i2] = charAnim.size()+getEnumFromString(playerAnim, backanim);
                         else
                             scripts[i][i2] = getEnumFromString(charAnim, backanim);
                     }
                     else
-                        scripts[i][i2] = j["animation"][i][1][i2];
-                    //std::cout << j["animation"][i][1][i2] << std::endl;
+                        scripts[i][i2] = script[i2].num;
                 }
             }
         }
     }
-     //   std::cout << "done lmao" << std::endl;
-    
 
     //copy over the shit into the arrays 
     Animation animations[new_char.size_animation];
+    memset(animations, 0, sizeof(animations));
     for (int i = 0; i < new_char.size_animation; i++)
     {
         animations[i].spd = anims[i].spd;
         for (int i2 = 0; i2 < scripts[i].size(); i2++)
             animations[i].script[i2] = scripts[i][i2];
     }
-//        std::cout << "anim lmao" << std::endl;
 
     //textures
-    new_char.size_textures = j["textures"].size();
+    new_char.size_textures = j.textures.size();
     
     char texpaths[new_char.size_textures][32];
-    for (int i = 0; i < j["textures"].size(); i++) {
-        std::string curtex = j["textures"][i];
-        strncpy(texpaths[i], curtex.c_str(), 32);
-    }
+    for (int i = 0; i < j.textures.size(); i++)
+        strncpy(texpaths[i], j.textures[i].c_str(), 32);
 
    //     std::cout << "tex lmao" << std::endl;
     std::ofstream binFile(std::string(argv[1]), std::ostream::binary);
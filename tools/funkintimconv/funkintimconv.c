@@ -29,6 +29,343 @@ typedef union
     uint16_t v;
 } RGBI;
 
+//Colour quantization
+#define QUANT_KMEANS_PASSES 16
+
+typedef enum
+{
+    Dither_None,
+    Dither_FloydSteinberg,
+    Dither_Ordered,
+} DitherMode;
+
+typedef struct
+{
+    uint16_t v;     //RGBI colour
+    uint32_t count; //Number of pixels of this colour
+    float p[3];     //Position in Quant_Space
+} QuantColour;
+
+typedef struct
+{
+    int start, end; //Range of colours in the box
+    int axis;       //Axis with the most variance
+    double error;   //Variance of the colours, 0 if it can't be split
+} QuantBox;
+
+static const uint8_t bayer_matrix[4][4] = {
+    { 0,  8,  2, 10},
+    {12,  4, 14,  6},
+    { 3, 11,  1,  9},
+    {15,  7, 13,  5},
+};
+
+static void Quant_Space(float r, float g, float b, float p[3])
+{
+    //Luma weighted YCbCr, so the palette goes to differences in brightness
+    //before differences in hue that are much harder to see
+    float y = 0.299f * r + 0.587f * g + 0.114f * b;
+    p[0] = y;
+    p[1] = 0.564f * 0.75f * (b - y);
+    p[2] = 0.713f * 0.75f * (r - y);
+}
+
+static int Quant_Nearest(float (*pal_p)[3], int pal_n, const float p[3])
+{
+    int best_i = 0;
+    float best = 0.0f;
+    for (int i = 0; i < pal_n; i++)
+    {
+        float d0 = pal_p[i][0] - p[0];
+        float d1 = pal_p[i][1] - p[1];
+        float d2 = pal_p[i][2] - p[2];
+        float d = d0 * d0 + d1 * d1 + d2 * d2;
+        if (i == 0 || d < best)
+        {
+            best_i = i;
+            best = d;
+        }
+    }
+    return best_i;
+}
+
+static int quant_sort_axis;
+
+static int Quant_Compare(const void *a, const void *b)
+{
+    float pa = ((const QuantColour*)a)->p[quant_sort_axis];
+    float pb = ((const QuantColour*)b)->p[quant_sort_axis];
+    return (pa > pb) - (pa < pb);
+}
+
+static void Quant_MeasureBox(const QuantColour *cols, QuantBox *box)
+{
+    double n = 0.0, sum[3] = {0.0, 0.0, 0.0}, sq[3] = {0.0, 0.0, 0.0};
+    for (int i = box->start; i < box->end; i++)
+    {
+        n += cols[i].count;
+        for (int j = 0; j < 3; j++)
+        {
+            sum[j] += (double)cols[i].count * cols[i].p[j];
+            sq[j] += (double)cols[i].count * cols[i].p[j] * cols[i].p[j];
+        }
+    }
+    
+    box->axis = 0;
+    box->error = 0.0;
+    double best = -1.0;
+    for (int j = 0; j < 3; j++)
+    {
+        double var = sq[j] - sum[j] * sum[j] / n;
+        box->error += var;
+        if (var > best)
+        {
+            box->axis = j;
+            best = var;
+        }
+    }
+    if (box->end - box->start < 2)
+        box->error = 0.0;
+}
+
+static int Quant_MedianCut(QuantColour *cols, int cols_n, float (*pal)[3], int pal_n)
+{
+    QuantBox boxes[256];
+    int boxes_n = 1;
+    boxes[0].start = 0;
+    boxes[0].end = cols_n;
+    Quant_MeasureBox(cols, &boxes[0]);
+    
+    while (boxes_n < pal_n)
+    {
+        //Split the box with the most variance at its median along its widest axis
+        int split_i = -1;
+        for (int i = 0; i < boxes_n; i++)
+            if (boxes[i].error > 0.0 && (split_i < 0 || boxes[i].error > boxes[split_i].error))
+                split_i = i;
+        if (split_i < 0)
+            break;
+        
+        QuantBox *box = &boxes[split_i];
+        quant_sort_axis = box->axis;
+        qsort(cols + box->start, box->end - box->start, sizeof(QuantColour), Quant_Compare);
+        
+        uint64_t total = 0, left = 0;
+        for (int i = box->start; i < box->end; i++)
+            total += cols[i].count;
+        int mid;
+        for (mid = box->start + 1; mid < box->end - 1; mid++)
+        {
+            left += cols[mid - 1].count;
+            if (left * 2 >= total)
+                break;
+        }
+        
+        boxes[boxes_n].start = mid;
+        boxes[boxes_n].end = box->end;
+        box->end = mid;
+        Quant_MeasureBox(cols, box);
+        Quant_MeasureBox(cols, &boxes[boxes_n]);
+        boxes_n++;
+    }
+    
+    //Start off with the mean colour of every box
+    for (int i = 0; i < boxes_n; i++)
+    {
+        double n = 0.0, sum[3] = {0.0, 0.0, 0.0};
+        for (int j = boxes[i].start; j < boxes[i].end; j++)
+        {
+            RGBI rep;
+            rep.v = cols[j].v;
+            n += cols[j].count;
+            sum[0] += (double)cols[j].count * rep.c.r;
+            sum[1] += (double)cols[j].count * rep.c.g;
+            sum[2] += (double)cols[j].count * rep.c.b;
+        }
+        for (int j = 0; j < 3; j++)
+            pal[i][j] = sum[j] / n;
+    }
+    return boxes_n;
+}
+
+static void Quant_KMeans(const QuantColour *cols, int cols_n, float (*pal)[3], int pal_n)
+{
+    //Move every palette colour to the mean of the colours nearest to it until
+    //they stop changing, which fixes up the straight cuts median cut makes
+    static int assign[0x8000];
+    for (int i = 0; i < cols_n; i++)
+        assign[i] = -1;
+    
+    for (int pass = 0; pass < QUANT_KMEANS_PASSES; pass++)
+    {
+        float pal_p[256][3];
+        double sum[256][4];
+        for (int i = 0; i < pal_n; i++)
+        {
+            Quant_Space(pal[i][0], pal[i][1], pal[i][2], pal_p[i]);
+            sum[i][0] = sum[i][1] = sum[i][2] = sum[i][3] = 0.0;
+        }
+        
+        int changed = 0;
+        for (int i = 0; i < cols_n; i++)
+        {
+            int near_i = Quant_Nearest(pal_p, pal_n, cols[i].p);
+            if (near_i != assign[i])
+            {
+                assign[i] = near_i;
+                changed++;
+            }
+            
+            RGBI rep;
+            rep.v = cols[i].v;
+            sum[near_i][0] += (double)cols[i].count * rep.c.r;
+            sum[near_i][1] += (double)cols[i].count * rep.c.g;
+            sum[near_i][2] += (double)cols[i].count * rep.c.b;
+            sum[near_i][3] += cols[i].count;
+        }
+        if (!changed)
+            break;
+        
+        for (int i = 0; i < pal_n; i++)
+            if (sum[i][3] > 0.0)
+                for (int j = 0; j < 3; j++)
+                    pal[i][j] = sum[i][j] / sum[i][3];
+    }
+}
+
+static int Quant_Image(const stbi_uc *tex_data, const uint16_t *reps, const uint32_t *rep_count, int width, int height, RGBI *pal, int max_colour, DitherMode dither, uint8_t *indices)
+{
+    //Transparency can't be approximated, so it keeps the first entry to itself
+    int pal_n = 0;
+    if (rep_count[0])
+        pal[pal_n++].v = 0;
+    int opaque_i = pal_n;
+    
+    //Gather the opaque colours of the image
+    static QuantColour cols[0x8000];
+    int cols_n = 0;
+    for (int v = 0x8000; v < 0x10000; v++)
+    {
+        if (!rep_count[v])
+            continue;
+        RGBI rep;
+        rep.v = v;
+        cols[cols_n].v = v;
+        cols[cols_n].count = rep_count[v];
+        Quant_Space(rep.c.r, rep.c.g, rep.c.b, cols[cols_n].p);
+        cols_n++;
+    }
+    
+    //Pick the palette
+    float cent[256][3];
+    int cent_n = Quant_MedianCut(cols, cols_n, cent, max_colour - opaque_i);
+    Quant_KMeans(cols, cols_n, cent, cent_n);
+    
+    float pal_p[256][3];
+    int pal_rgb[256][3];
+    for (int i = 0; i < cent_n; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            int c = (int)(cent[i][j] + 0.5f);
+            pal_rgb[i][j] = (c < 0) ? 0 : (c > 31) ? 31 : c;
+        }
+        pal[pal_n].c.r = pal_rgb[i][0];
+        pal[pal_n].c.g = pal_rgb[i][1];
+        pal[pal_n].c.b = pal_rgb[i][2];
+        pal[pal_n].c.i = 1;
+        pal_n++;
+        Quant_Space(pal_rgb[i][0], pal_rgb[i][1], pal_rgb[i][2], pal_p[i]);
+    }
+    
+    //Ordered dithering is spread over about the distance between palette colours
+    int cube = 1;
+    while ((cube + 1) * (cube + 1) * (cube + 1) <= cent_n)
+        cube++;
+    float spread = 32.0f / cube;
+    
+    //Floyd-Steinberg error of this row and the next
+    float *err_row = NULL, *err_next = NULL;
+    if (dither == Dither_FloydSteinberg)
+    {
+        err_row = calloc((width + 2) * 3 * 2, sizeof(float));
+        if (err_row == NULL)
+            return -1;
+        err_next = err_row + (width + 2) * 3;
+    }
+    
+    //Map the pixels to the palette, remembering the nearest entry to every colour
+    static int near_lut[0x8000];
+    memset(near_lut, 0xFF, sizeof(near_lut));
+    
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            size_t i = (size_t)y * width + x;
+            if (!(reps[i] & 0x8000))
+            {
+                indices[i] = 0;
+                continue;
+            }
+            
+            const stbi_uc *src = &tex_data[i * 4];
+            float c[3];
+            int q[3];
+            for (int j = 0; j < 3; j++)
+            {
+                c[j] = src[j] / 8;
+                switch (dither)
+                {
+                    case Dither_None:
+                        break;
+                    case Dither_FloydSteinberg:
+                        c[j] += err_row[(x + 1) * 3 + j];
+                        break;
+                    case Dither_Ordered:
+                        c[j] += ((bayer_matrix[y & 3][x & 3] + 0.5f) / 16.0f - 0.5f) * spread;
+                        break;
+                }
+                c[j] = (c[j] < 0.0f) ? 0.0f : (c[j] > 31.0f) ? 31.0f : c[j];
+                q[j] = (int)(c[j] + 0.5f);
+            }
+            
+            int key = q[0] | (q[1] << 5) | (q[2] << 10);
+            if (near_lut[key] < 0)
+            {
+                float p[3];
+                Quant_Space(q[0], q[1], q[2], p);
+                near_lut[key] = Quant_Nearest(pal_p, cent_n, p);
+            }
+            int near_i = near_lut[key];
+            indices[i] = opaque_i + near_i;
+            
+            if (dither == Dither_FloydSteinberg)
+            {
+                for (int j = 0; j < 3; j++)
+                {
+                    float e = c[j] - pal_rgb[near_i][j];
+                    err_row[(x + 2) * 3 + j] += e * (7.0f / 16.0f);
+                    err_next[(x + 0) * 3 + j] += e * (3.0f / 16.0f);
+                    err_next[(x + 1) * 3 + j] += e * (5.0f / 16.0f);
+                    err_next[(x + 2) * 3 + j] += e * (1.0f / 16.0f);
+                }
+            }
+        }
+        
+        if (dither == Dither_FloydSteinberg)
+        {
+            float *swap = err_row;
+            err_row = err_next;
+            err_next = swap;
+            memset(err_next, 0, (width + 2) * 3 * sizeof(float));
+        }
+    }
+    
+    free((err_row < err_next) ? err_row : err_next);
+    return pal_n;
+}
+
 int main(int argc, char *argv[])
 {
     //Read parameters
@@ -60,14 +397,34 @@ int main(int argc, char *argv[])
     
     int tex_x, tex_y, pal_x, pal_y, bpp;
     int txtread = fscanf(txtfp, "%d %d %d %d %d", &tex_x, &tex_y, &pal_x, &pal_y, &bpp);
-    fclose(txtfp);
     
     if (txtread != 5)
     {
         printf("Failed to read parameters from %s.txt\n", inpath);
+        fclose(txtfp);
         return 1;
     }
     
+    //Read options
+    DitherMode dither = Dither_None;
+    char option[64];
+    while (fscanf(txtfp, "%63s", option) == 1)
+    {
+        if (!strcmp(option, "dither=none"))
+            dither = Dither_None;
+        else if (!strcmp(option, "dither=fs"))
+            dither = Dither_FloydSteinberg;
+        else if (!strcmp(option, "dither=ordered"))
+            dither = Dither_Ordered;
+        else
+        {
+            printf("Unknown option %s in %s.txt\n", option, inpath);
+            fclose(txtfp);
+            return 1;
+        }
+    }
+    fclose(txtfp);
+    
     //Validate parameters
     int max_colour, width_shift;
     switch (bpp)
@@ -101,25 +458,23 @@ int main(int argc, char *argv[])
         return 1;
     }
     
-    //Convert image
-    RGBI pal[256];
-    int pals_i = 0;
-    memset(pal, 0, sizeof(pal));
-    
-    size_t tex_size = ((tex_width << 1) >> width_shift) * tex_height;
-    uint8_t *tex = malloc(tex_size);
-    if (tex == NULL)
+    //Get palette representation of every pixel
+    size_t pixels = (size_t)tex_width * tex_height;
+    uint16_t *reps = malloc(pixels * sizeof(uint16_t));
+    uint8_t *indices = malloc(pixels);
+    if (reps == NULL || indices == NULL)
     {
-        printf("Failed to allocate texture buffer\n");
+        printf("Failed to allocate pixel buffers\n");
+        free(reps);
+        free(indices);
         stbi_image_free(tex_data);
         return 1;
     }
     
+    static uint32_t rep_count[0x10000];
     stbi_uc *tex_datap = tex_data;
-    uint8_t *texp = tex;
-    for (int i = tex_width * tex_height; i > 0; i--, tex_datap += 4)
+    for (size_t i = 0; i < pixels; i++, tex_datap += 4)
     {
-        //Get palette representation
         RGBI rep;
         if (tex_datap[3] & 0x80)
         {
@@ -137,35 +492,69 @@ int main(int argc, char *argv[])
             rep.c.b = 0;
             rep.c.i = 0;
         }
-        
-        //Get palette index
-        int pal_i = 0;
-        while (1)
+        reps[i] = rep.v;
+        rep_count[rep.v]++;
+    }
+    
+    //Build palette in the order the colours first appear, finding them with a
+    //table indexed by colour instead of searching the palette for every pixel
+    RGBI pal[256];
+    int pals_i = 0;
+    memset(pal, 0, sizeof(pal));
+    
+    static int pal_lut[0x10000];
+    memset(pal_lut, 0xFF, sizeof(pal_lut));
+    for (size_t i = 0; i < pixels; i++)
+    {
+        if (pal_lut[reps[i]] >= 0)
+            continue;
+        if (pals_i < max_colour)
+            pal[pals_i].v = reps[i];
+        pal_lut[reps[i]] = pals_i++;
+    }
+    
+    if (pals_i <= max_colour)
+    {
+        for (size_t i = 0; i < pixels; i++)
+            indices[i] = pal_lut[reps[i]];
+    }
+    else
+    {
+        //Too many colours, quantize the image to fit the palette
+        memset(pal, 0, sizeof(pal));
+        if (Quant_Image(tex_data, reps, rep_count, tex_width, tex_height, pal, max_colour, dither, indices) < 0)
         {
-            if (pal_i >= max_colour)
-            {
-                printf("Image has more than %d colours\n", max_colour);
-                free(tex);
-                stbi_image_free(tex_data);
-                return 1;
-            }
-            if (pal_i >= pals_i)
-            {
-                pal[pal_i].v = rep.v;
-                pals_i++;
-                break;
-            }
-            if (pal[pal_i].v == rep.v)
-                break;
-            pal_i++;
+            printf("Failed to allocate dither buffer\n");
+            free(reps);
+            free(indices);
+            stbi_image_free(tex_data);
+            return 1;
         }
-        
+        printf("%s has %d colours, quantized to %d\n", inpath, pals_i, max_colour);
+    }
+    free(reps);
+    
+    //Convert image
+    size_t tex_size = ((tex_width << 1) >> width_shift) * tex_height;
+    uint8_t *tex = calloc(tex_size, 1);
+    if (tex == NULL)
+    {
+        printf("Failed to allocate texture buffer\n");
+        free(indices);
+        stbi_image_free(tex_data);
+        return 1;
+    }
+    
+    uint8_t *texp = tex;
+    for (size_t i = 0; i < pixels; i++)
+    {
         //Write pixel
+        int pal_i = indices[i];
         switch (bpp)
         {
             case 4:
                 if (i & 1)
-                    *texp++ = *texp | (pal_i << 4);
+                    *texp++ |= pal_i << 4;
                 else
                     *texp = pal_i;
                 break;
@@ -174,6 +563,7 @@ int main(int argc, char *argv[])
                 break;
         }
     }
+    free(indices);
     stbi_image_free(tex_data);
     
     int dawidth = 0;
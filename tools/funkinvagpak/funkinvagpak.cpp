@@ -5,8 +5,8 @@
 */
 
 /*
-  Uses ADPCM conversion by spicyjpeg
-  (C) 2021 spicyjpeg
+  Uses libpsxav's ADPCM encoder (shared with psxavenc)
+  (C) 2019, 2020 Adrian "asie" Siekierka, 2019 Ben "GreaseMonkey" Russell, 2023 spicyjpeg
 */
 
 #define NOMINMAX
@@ -19,6 +19,12 @@
 #include <string>
 #include <iomanip>
 #include <cstring>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <cmath>
+#include <filesystem>
+#include <sstream>
 
 // https://miniaud.io/docs/manual/index.html#Decoding
 #define STB_VORBIS_HEADER_ONLY
@@ -34,15 +40,152 @@
 #undef STB_VORBIS_HEADER_ONLY
 #include "stb_vorbis.c"
 
-#include "adpcm.h"
+#include "libpsxav.h"
 
 //Audio constants
 #define DEFAULT_SAMPLE_RATE 44100
 #define DEFAULT_BUFFER_SIZE 2048
 
+//Chunks between ADPCM sync points, where a channel can be split up to encode in parallel
+//Each sync point costs the first block of a chunk its filter search (about one in 8192 blocks)
+#define SYNC_CHUNKS 64
+
+//With --fast, every Nth range of a channel is also encoded exhaustively to measure the SNR loss
+#define FAST_COMPARE_RANGES 8
+
+//Bump whenever the encoder's output changes so --cache doesn't reuse stale channels
+#define CACHE_VERSION 1
+
+//Integrated loudness (in LUFS) songs get turned down to with the header's gain table, overridden by --loudness
+//The SPU can't play a channel louder than full volume, so quieter songs are left as they are
+#define DEFAULT_LOUDNESS -14.0
+
+//Header flags, the game reads them through VAG_Header in src/vag.h
+#define VAG_FLAG_GAIN  (1 << 0) //Gain table at 0x30 holds a 4.12 fixed point volume scale for each channel
+#define VAG_FLAG_PITCH (1 << 1) //Pitch table at 0x60 holds each channel's 4.12 fixed point sample rate relative to the stream's
+#define VAG_FLAG_ROLE  (1 << 2) //Role table at 0x90 holds each channel's role (low nibble) and pan (high nibble)
+#define VAG_MAX_CHANNELS 24
+
+//Channel roles and pans, matching AudioRole in the game's audio.h
+static const char *const vag_roles[] = {"inst", "vocal", "player", "opponent"};
+static const char *const vag_pans[] = {"left", "right", "center"};
+
+//Biquad section, transposed direct form II
+struct Biquad
+{
+    double b0 = 1.0, b1 = 0.0, b2 = 0.0, a1 = 0.0, a2 = 0.0;
+    double z1 = 0.0, z2 = 0.0;
+
+    double Filter(double x)
+    {
+        double y = b0 * x + z1;
+        z1 = b1 * x - a1 * y + z2;
+        z2 = b2 * x - a2 * y;
+        return y;
+    }
+};
+
+//ITU-R BS.1770 loudness measurement of one channel, fed a window at a time
+struct LoudnessMeter
+{
+    //K-weighting filter
+    Biquad shelf, highpass;
+
+    //Mean square of every 100ms of K-weighted audio
+    size_t sub_block_samples = 0;
+    double sum = 0.0;
+    size_t count = 0;
+    std::vector<double> sub_blocks;
+
+    //Sample peak
+    int peak = 0;
+
+    void Init(int sample_rate)
+    {
+        //Coefficients for any sample rate, from the analog prototypes of the filters in the spec
+        double w0 = 2.0 * M_PI * 1681.974450955533 / sample_rate;
+        double A = std::pow(10.0, 3.99984385397 / 40.0);
+        double alpha = std::sin(w0) / (2.0 * 0.7071752369554193);
+        double a0 = (A + 1.0) - (A - 1.0) * std::cos(w0) + 2.0 * std::sqrt(A) * alpha;
+        shelf.b0 = A * ((A + 1.0) + (A - 1.0) * std::cos(w0) + 2.0 * std::sqrt(A) * alpha) / a0;
+        shelf.b1 = -2.0 * A * ((A - 1.0) + (A + 1.0) * std::cos(w0)) / a0;
+        shelf.b2 = A * ((A + 1.0) + (A - 1.0) * std::cos(w0) - 2.0 * std::sqrt(A) * alpha) / a0;
+        shelf.a1 = 2.0 * ((A - 1.0) - (A + 1.0) * std::cos(w0)) / a0;
+        shelf.a2 = ((A + 1.0) - (A - 1.0) * std::cos(w0) - 2.0 * std::sqrt(A) * alpha) / a0;
+
+        w0 = 2.0 * M_PI * 38.13547087613982 / sample_rate;
+        alpha = std::sin(w0) / (2.0 * 0.5003270373253953);
+        a0 = 1.0 + alpha;
+        highpass.b0 = (1.0 + std::cos(w0)) / 2.0 / a0;
+        highpass.b1 = -(1.0 + std::cos(w0)) / a0;
+        highpass.b2 = (1.0 + std::cos(w0)) / 2.0 / a0;
+        highpass.a1 = -2.0 * std::cos(w0) / a0;
+        highpass.a2 = (1.0 - alpha) / a0;
+
+        sub_block_samples = sample_rate / 10;
+    }
+
+    void Feed(const int16_t *samples, size_t num_samples)
+    {
+        for (size_t i = 0; i < num_samples; i++)
+        {
+            peak = std::max(peak, std::abs((int)samples[i]));
+
+            double x = highpass.Filter(shelf.Filter(samples[i] / 32768.0));
+            sum += x * x;
+            if (++count == sub_block_samples)
+            {
+                sub_blocks.push_back(sum / count);
+                sum = 0.0;
+                count = 0;
+            }
+        }
+    }
+};
+
+static double PowerToLoudness(double power)
+{
+    return -0.691 + 10.0 * std::log10(power);
+}
+
+//Gated integrated loudness of 100ms mean squares (already summed over channels), in LUFS
+static double GetIntegratedLoudness(const std::vector<double> &sub_blocks)
+{
+    //400ms blocks overlapping by 75%
+    std::vector<double> blocks;
+    for (size_t i = 0; i + 4 <= sub_blocks.size(); i++)
+        blocks.push_back((sub_blocks[i] + sub_blocks[i + 1] + sub_blocks[i + 2] + sub_blocks[i + 3]) / 4.0);
+
+    //Average the blocks above the absolute gate, then again only those above the relative gate 10LU below that
+    double gate = -70.0;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        double sum = 0.0;
+        size_t count = 0;
+        for (double power : blocks)
+        {
+            if (power > 0.0 && PowerToLoudness(power) > gate)
+            {
+                sum += power;
+                count++;
+            }
+        }
+        if (!count)
+            return -HUGE_VAL;
+        if (pass)
+            return PowerToLoudness(sum / count);
+        gate = PowerToLoudness(sum / count) - 10.0;
+    }
+    return -HUGE_VAL;
+}
+
 struct InputAudio
 {
-    //Audio data
+    //Decoder, resampling to the stream's sample rate divided by divider
+    ma_decoder decoder;
+    size_t divider;
+
+    //Audio data of the current window
     std::vector<int16_t> data;
 };
 
@@ -51,10 +194,30 @@ struct VagChannel
     //Descriptor
     std::string path;
     float use_l = 0.0f, use_r = 0.0f;
+    int sample_rate = 0;
+
+    //Stream sample rate divided by sample_rate, each chunk holds buffer_size / divider bytes of this channel
+    size_t divider = 1;
+
+    //What the game does with the channel, and where it plays it (-1 alternates left and right)
+    int role = 0, pan = -1;
     
-    //Audio data
+    //Audio data of the current window
     InputAudio *audio = nullptr;
     std::vector<uint8_t> adpcm;
+
+    //Cache entry (--cache only)
+    std::string cache_path;
+    bool cached = false;
+    std::ifstream cache_in;
+    std::ofstream cache_out;
+
+    //SNR measurement (--fast only)
+    uint64_t signal = 0, error = 0, error_exhaustive = 0;
+
+    //Loudness of the encoded audio, decoded as the SPU would play it
+    int decode_prev[2] = {0, 0};
+    LoudnessMeter loudness;
 };
 
 void write_int16_little(uint8_t *ptr, int16_t value) {
@@ -81,16 +244,132 @@ void write_int32_big(uint8_t *ptr, int32_t value) {
     ptr[3] = (uint8_t) ((value >>  0) & 0xff);
 }
 
+//FNV-1a, continuing from hash
+static uint64_t HashData(uint64_t hash, const void *data, size_t size)
+{
+    const uint8_t *bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 0x100000001B3;
+    return hash;
+}
+
+static bool HashFile(const std::string &path, uint64_t &hash)
+{
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream.is_open())
+        return false;
+
+    hash = 0xCBF29CE484222325;
+    char buffer[0x10000];
+    while (stream.read(buffer, sizeof(buffer)) || stream.gcount())
+        hash = HashData(hash, buffer, stream.gcount());
+    return true;
+}
+
+//Decodes SPU-ADPCM, carrying the last two samples over in prev
+static void DecodeADPCM(const uint8_t *adpcm, int16_t *samples, size_t num_samples, int prev[2])
+{
+    static const int filter_k1[] = {0, 60, 115, 98, 122};
+    static const int filter_k2[] = {0, 0, -52, -55, -60};
+
+    for (size_t i = 0; i < num_samples; i++)
+    {
+        const uint8_t *block = adpcm + (i / 28) * 16;
+        int shift = block[0] & 0xF, filter = std::min(block[0] >> 4, 4);
+        int nibble = (block[2 + (i % 28) / 2] >> ((i & 1) * 4)) & 0xF;
+
+        int sample = (int16_t)(nibble << 12) >> shift;
+        sample += (filter_k1[filter] * prev[0] + filter_k2[filter] * prev[1] + 32) >> 6;
+        sample = std::min(std::max(sample, -0x8000), 0x7FFF);
+        prev[1] = prev[0];
+        prev[0] = sample;
+        samples[i] = sample;
+    }
+}
+
+//Decodes SPU-ADPCM starting from silence, returning the squared error against the original samples
+static uint64_t GetADPCMError(const uint8_t *adpcm, const int16_t *samples, size_t num_samples)
+{
+    std::vector<int16_t> decoded(num_samples);
+    int prev[2] = {0, 0};
+    DecodeADPCM(adpcm, decoded.data(), num_samples, prev);
+
+    uint64_t error = 0;
+    for (size_t i = 0; i < num_samples; i++)
+    {
+        int64_t diff = decoded[i] - samples[i];
+        error += diff * diff;
+    }
+    return error;
+}
+
+static size_t GetNumThreads()
+{
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+//Runs func(i) for every i below num_jobs, spread over a thread per core
+static void RunParallel(size_t num_jobs, const std::function<void(size_t)> &func)
+{
+    std::atomic<size_t> next_job(0);
+    auto worker = [&]() {
+        for (size_t i; (i = next_job++) < num_jobs;)
+            func(i);
+    };
+
+    size_t num_threads = std::min(GetNumThreads(), num_jobs);
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < num_threads; i++)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &i : threads)
+        i.join();
+}
+
 //Entry point
 int main(int argc, char *argv[])
 {
     int sample_rate = DEFAULT_SAMPLE_RATE;
     size_t buffer_size = DEFAULT_BUFFER_SIZE;
 
+    //--fast trades a little quality for a much faster filter search, for iteration builds
+    //--cache keeps every channel's ADPCM in cache_dir so only channels whose source or mix changed get encoded again
+    //--loudness sets the loudness songs are turned down to, only the header changes with it so cached channels are still reused
+    bool fast = false;
+    std::string cache_dir;
+    double target_loudness = DEFAULT_LOUDNESS;
+    while (argc >= 2 && std::string(argv[1]).rfind("--", 0) == 0)
+    {
+        std::string option = argv[1];
+        if (option == "--fast")
+        {
+            fast = true;
+        }
+        else if (option == "--cache" && argc >= 3)
+        {
+            cache_dir = argv[2];
+            argv++;
+            argc--;
+        }
+        else if (option == "--loudness" && argc >= 3)
+        {
+            target_loudness = strtod(argv[2], nullptr);
+            argv++;
+            argc--;
+        }
+        else
+        {
+            std::cout << "Unknown option " << option << std::endl;
+            return 1;
+        }
+        argv++;
+        argc--;
+    }
+
     //Check arguments
     if (argc < 3) {
-        std::cout << "usage: funkinvagpak out_vag in_txt [sample_rate] [interleave]" << std::endl;
-        std::cout << "default values: sample_rate=" << DEFAULT_SAMPLE_RATE << ", interleave=" << DEFAULT_BUFFER_SIZE << std::endl;
+        std::cout << "usage: funkinvagpak [--fast] [--cache cache_dir] [--loudness lufs] out_vag in_txt [sample_rate] [interleave]" << std::endl;
+        std::cout << "default values: sample_rate=" << DEFAULT_SAMPLE_RATE << ", interleave=" << DEFAULT_BUFFER_SIZE << ", loudness=" << DEFAULT_LOUDNESS << std::endl;
         return 1;
     }
     if (argc >= 4)
@@ -117,86 +396,170 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    size_t samples_per_buffer = buffer_size / spu::BLOCK_LENGTH * spu::BLOCK_NUM_SAMPLES;
-    int16_t *pcm_read_buffer = new int16[samples_per_buffer * 2];
-
-    //Read channels
-    size_t max_length = 0;
-
-    while (!stream_txt.eof())
+    //Read channel descriptors, one per line with optional settings after the mix
+    std::string line;
+    while (std::getline(stream_txt, line))
     {
-        //Read descriptor
+        std::istringstream stream_line(line);
         VagChannel channel;
-        stream_txt >> std::quoted(channel.path) >> channel.use_l >> channel.use_r;
+        stream_line >> std::quoted(channel.path) >> channel.use_l >> channel.use_r;
         if (!channel.path.size())
             continue;
 
-        std::cout << "Encoding " << channel.path << " [L=" << channel.use_l << ", R=" << channel.use_r << "]" << std::endl;
+        //rate=N encodes the channel at a lower sample rate, for stems without much high end (bass, drums)
+        //role= and pan= tell the game what the channel is (so it knows which ones to mute) and where to play it
+        auto find_name = [](const std::string &name, const char *const *names, size_t num_names, int &value) {
+            for (size_t i = 0; i < num_names; i++)
+            {
+                if (name == names[i])
+                {
+                    value = (int)i;
+                    return true;
+                }
+            }
+            return false;
+        };
 
-        //Read audio
-        auto audio_find = vag_audio.find(channel.path);
-        if (audio_find != vag_audio.end())
+        std::string setting;
+        while (stream_line >> setting)
         {
-            //Use already loaded audio
-            channel.audio = &audio_find->second;
+            bool valid = true;
+            if (setting.rfind("rate=", 0) == 0)
+                channel.sample_rate = strtoul(setting.c_str() + 5, nullptr, 0);
+            else if (setting.rfind("role=", 0) == 0)
+                valid = find_name(setting.substr(5), vag_roles, std::size(vag_roles), channel.role);
+            else if (setting.rfind("pan=", 0) == 0)
+                valid = find_name(setting.substr(4), vag_pans, std::size(vag_pans), channel.pan);
+            else
+                valid = false;
+
+            if (!valid)
+            {
+                std::cout << "Unknown setting " << setting << " for " << channel.path << std::endl;
+                return 1;
+            }
         }
-        else
+        if (channel.pan < 0)
+            channel.pan = vag_channels.size() % 2;
+
+        vag_channels.push_back(std::move(channel));
+    }
+
+    //Close txt file
+    stream_txt.close();
+
+    if (vag_channels.size() > VAG_MAX_CHANNELS)
+    {
+        std::cout << "Too many channels in " << path_txt << " (" << vag_channels.size() << ", max " << VAG_MAX_CHANNELS << ")" << std::endl;
+        return 1;
+    }
+
+    //Channels at a lower rate have to fill the same time per chunk in whole blocks, so only power of 2 fractions work
+    size_t block_length = psx_audio_spu_get_buffer_size_per_block();
+    size_t block_samples = psx_audio_spu_get_samples_per_block();
+    for (auto &channel : vag_channels)
+    {
+        if (!channel.sample_rate)
+            channel.sample_rate = sample_rate;
+
+        channel.divider = sample_rate / std::max(channel.sample_rate, 1);
+        if (!channel.divider || channel.divider & (channel.divider - 1) ||
+            channel.divider * channel.sample_rate != (size_t)sample_rate ||
+            (buffer_size / block_length) % channel.divider)
         {
-            //Load audio
-            std::string path = path_base + channel.path;
-            InputAudio audio;
+            std::cout << "Unsupported sample rate " << channel.sample_rate << " for " << channel.path
+                      << " (must be " << sample_rate << " divided by a power of 2 that splits a chunk into whole blocks)" << std::endl;
+            return 1;
+        }
+
+        channel.loudness.Init(channel.sample_rate);
+    }
 
-            //Create miniaudio decoder
-            ma_decoder decoder;
-            ma_decoder_config decoder_config = ma_decoder_config_init(ma_format_s16, 2, sample_rate);
+    //Look for channels that were already encoded with the same source file, mix and settings
+    if (!cache_dir.empty())
+    {
+        std::error_code error;
+        std::filesystem::create_directories(cache_dir, error);
 
-            if (ma_decoder_init_file(path.c_str(), &decoder_config, &decoder) != MA_SUCCESS)
+        std::unordered_map<std::string, uint64_t> file_hashes;
+        for (auto &channel : vag_channels)
+        {
+            auto hash_find = file_hashes.find(channel.path);
+            if (hash_find == file_hashes.end())
             {
-                std::cout << "Failed to open audio " << path << std::endl;
-                return 1;
+                uint64_t file_hash;
+                if (!HashFile(path_base + channel.path, file_hash))
+                    continue; //Let decoding report the missing file
+                hash_find = file_hashes.emplace(channel.path, file_hash).first;
             }
 
-            std::cout << "  Decoding " << channel.path << std::endl;
+            uint64_t key = hash_find->second;
+            int32_t settings[] = {CACHE_VERSION, sample_rate, channel.sample_rate, (int32_t)buffer_size, SYNC_CHUNKS, fast};
+            key = HashData(key, settings, sizeof(settings));
+            key = HashData(key, &channel.use_l, sizeof(channel.use_l));
+            key = HashData(key, &channel.use_r, sizeof(channel.use_r));
 
-            //Read PCM data and buffer it in memory
-            while (1) {
-                size_t length = ma_decoder_read_pcm_frames(&decoder, pcm_read_buffer, samples_per_buffer);
-                if (!length)
-                    break;
+            std::ostringstream name;
+            name << std::hex << std::setw(16) << std::setfill('0') << key << ".adpcm";
+            channel.cache_path = (std::filesystem::path(cache_dir) / name.str()).string();
 
-                audio.data.insert(audio.data.end(), pcm_read_buffer, &pcm_read_buffer[length * 2]);
+            std::error_code error;
+            auto cache_size = std::filesystem::file_size(channel.cache_path, error);
+            if (!error && cache_size % psx_audio_spu_get_buffer_size_per_block() == 0)
+            {
+                channel.cache_in.open(channel.cache_path, std::ios::binary);
+                channel.cached = channel.cache_in.is_open();
             }
+        }
+    }
 
-            //Delete miniaudio decoder
-            ma_decoder_uninit(&decoder);
+    for (auto &channel : vag_channels)
+    {
+        std::cout << (channel.cached ? "Reusing " : "Encoding ") << channel.path << " [L=" << channel.use_l << ", R=" << channel.use_r;
+        if (channel.divider != 1)
+            std::cout << ", " << channel.sample_rate << "Hz";
+        std::cout << (channel.cached ? "] from cache" : "]") << std::endl;
+    }
 
-            //Push audio to audio map
-            vag_audio[channel.path] = audio;
-            channel.audio = &vag_audio[channel.path];
-        }
+    //Open a decoder for every input file and sample rate still needed
+    std::vector<InputAudio*> audio_files;
+    for (auto &channel : vag_channels)
+    {
+        if (channel.cached)
+            continue;
 
-        //Mix audio
-        std::vector<int16_t> mix_buffer(channel.audio->data.size() / 2);
-        for (size_t i = 0; i < mix_buffer.size(); i++) {
-            auto data = &(channel.audio->data[i*2]);
-            mix_buffer[i] = (int16_t)((float)data[0] * channel.use_l + (float)data[1] * channel.use_r);
-        }
+        std::string audio_key = channel.path + "@" + std::to_string(channel.sample_rate);
+        auto audio_find = vag_audio.find(audio_key);
+        if (audio_find == vag_audio.end())
+        {
+            //Decoders are initialized in place as they can't be moved around
+            audio_find = vag_audio.emplace(std::piecewise_construct, std::forward_as_tuple(audio_key), std::forward_as_tuple()).first;
+            InputAudio &audio = audio_find->second;
+            audio.divider = channel.divider;
 
-        //Encode audio to ADPCM
-        size_t length = spu::getNumBlocks(mix_buffer.size()) * spu::BLOCK_LENGTH;
-        channel.adpcm.resize(length);
-        spu::encodeSound(mix_buffer.data(), channel.adpcm.data(), mix_buffer.size(), mix_buffer.size());
-        max_length = std::max(max_length, length);
+            std::string path = path_base + channel.path;
+            ma_decoder_config decoder_config = ma_decoder_config_init(ma_format_s16, 2, channel.sample_rate);
+            if (ma_decoder_init_file(path.c_str(), &decoder_config, &audio.decoder) != MA_SUCCESS)
+            {
+                std::cout << "Failed to open audio " << path << std::endl;
+                return 1;
+            }
+            audio_files.push_back(&audio);
 
-        //Push channel to channel list
-        vag_channels.push_back(channel);
+            std::cout << "  Decoding " << channel.path << std::endl;
+        }
+        channel.audio = &audio_find->second;
     }
 
-    //Close txt file
-    stream_txt.close();
-    delete[] pcm_read_buffer;
+    //Open the cache entries to write
+    for (auto &channel : vag_channels)
+    {
+        if (channel.cached || channel.cache_path.empty())
+            continue;
+        channel.cache_out.open(channel.cache_path + ".tmp", std::ios::binary);
+    }
 
-    //Write vag file
+    //Open vag file, the header gets written once the length is known
     std::ofstream stream_vag(path_vag, std::ios::binary);
     if (!stream_vag.is_open())
     {
@@ -206,40 +569,249 @@ int main(int argc, char *argv[])
 
     std::cout << "Writing " << vag_channels.size() << " channels to " << path_vag << std::endl;
 
-    //Write meta header
     uint8_t header[2048] = {};
+    stream_vag.write((const char*)header, 2048);
 
-    memcpy(&header[0x0], "VAGi", 4);
-    write_int32_big(&header[0x4], 0x20); // version
-    write_int32_little(&header[0x8], buffer_size); // buffer size
-    write_int32_big(&header[0xc], max_length); // size of audio data  for each channel
-    write_int32_big(&header[0x10], sample_rate); // sample rate
-    memset(&header[0x14], 0, 10);
-    write_int16_little(&header[0x1e], vag_channels.size()); // channels
-    strncpy((char*)&header[0x20], path_vag.c_str(), 16); // file name
+    //Stream the song through in windows of whole sync ranges, enough for every thread to have a range to encode
+    //Ranges (and so the output) don't depend on the window size, which only bounds how much audio is in memory
+    //Block counts are at the stream's sample rate, channels at a lower rate have divider times fewer
+    uint32_t sync_blocks = SYNC_CHUNKS * (buffer_size / block_length);
 
-    stream_vag.write((const char*)header, 2048);
+    size_t window_ranges = (GetNumThreads() + vag_channels.size() - 1) / vag_channels.size();
+    size_t window_blocks = window_ranges * sync_blocks;
+    size_t window_samples = window_blocks * block_samples;
 
-    size_t num_chunks = (max_length + (buffer_size - 1)) / buffer_size;
-    for (size_t i = 0; i < num_chunks; i++)
+    struct EncodeJob
     {
-        size_t offset = i * buffer_size;
+        size_t channel;
+        uint32_t first_block, num_blocks; //Relative to the window
+        bool sync;
+
+        //SNR measurement (--fast only)
+        bool compare;
+        uint64_t signal, error, error_exhaustive;
+    };
+    std::vector<EncodeJob> encode_jobs;
+    std::vector<std::vector<int16_t>> mix_buffers(vag_channels.size());
+
+    size_t max_length = 0;
+    for (size_t window_block = 0;; window_block += window_blocks)
+    {
+        //Decode the window of every input file
+        RunParallel(audio_files.size(), [&](size_t i) {
+            InputAudio &audio = *audio_files[i];
+            size_t audio_samples = window_samples / audio.divider;
+            audio.data.resize(audio_samples * 2);
+
+            size_t length = 0;
+            while (length < audio_samples)
+            {
+                size_t read = ma_decoder_read_pcm_frames(&audio.decoder, &audio.data[length * 2], audio_samples - length);
+                if (!read)
+                    break;
+                length += read;
+            }
+            audio.data.resize(length * 2);
+        });
+
+        //Mix audio, or read it back from the cache
+        RunParallel(vag_channels.size(), [&](size_t i) {
+            auto &channel = vag_channels[i];
+            auto &mix_buffer = mix_buffers[i];
+
+            if (channel.cached)
+            {
+                channel.adpcm.resize(window_blocks / channel.divider * block_length);
+                channel.cache_in.read((char*)channel.adpcm.data(), channel.adpcm.size());
+                channel.adpcm.resize(channel.cache_in.gcount());
+                return;
+            }
+
+            mix_buffer.resize(channel.audio->data.size() / 2);
+            for (size_t j = 0; j < mix_buffer.size(); j++) {
+                auto data = &(channel.audio->data[j*2]);
+                mix_buffer[j] = (int16_t)((float)data[0] * channel.use_l + (float)data[1] * channel.use_r);
+            }
+            channel.adpcm.resize(psx_audio_spu_get_buffer_size(mix_buffer.size()));
+        });
 
-        //Write chunk buffers
+        //Encode audio to ADPCM, splitting each channel into ranges of SYNC_CHUNKS chunks
+        encode_jobs.clear();
+        for (size_t i = 0; i < vag_channels.size(); i++)
+        {
+            auto &channel = vag_channels[i];
+            if (channel.cached)
+                continue;
+            uint32_t num_blocks = channel.adpcm.size() / block_length;
+            uint32_t range_blocks = sync_blocks / channel.divider;
+            for (uint32_t j = 0; j < num_blocks; j += range_blocks)
+            {
+                size_t range = (window_block / channel.divider + j) / range_blocks;
+                encode_jobs.push_back({i, j, std::min(range_blocks, num_blocks - j), range != 0, fast && range % FAST_COMPARE_RANGES == 0, 0, 0, 0});
+            }
+        }
+
+        RunParallel(encode_jobs.size(), [&](size_t i) {
+            auto &job = encode_jobs[i];
+            auto &mix_buffer = mix_buffers[job.channel];
+
+            //Ranges after the first start with a filter 0 block, so they don't depend on the previous range
+            size_t first_sample = job.first_block * block_samples;
+            int16_t *samples = mix_buffer.data() + first_sample;
+            int sample_count = (int)std::min(job.num_blocks * block_samples, mix_buffer.size() - first_sample);
+            uint8_t *output = vag_channels[job.channel].adpcm.data() + job.first_block * block_length;
+
+            auto encode = [&](psx_audio_adpcm_quality_t quality, uint8_t *output) {
+                psx_audio_encoder_channel_state_t state = {};
+                state.quality = quality;
+                if (job.sync)
+                    psx_audio_spu_encode_sync(&state, samples, sample_count, 1, output);
+                else
+                    psx_audio_spu_encode(&state, samples, sample_count, 1, output);
+            };
+
+            encode(fast ? PSX_AUDIO_ADPCM_FAST : PSX_AUDIO_ADPCM_EXHAUSTIVE, output);
+
+            if (job.compare)
+            {
+                std::vector<uint8_t> exhaustive(job.num_blocks * block_length);
+                encode(PSX_AUDIO_ADPCM_EXHAUSTIVE, exhaustive.data());
+
+                for (int j = 0; j < sample_count; j++)
+                    job.signal += (int64_t)samples[j] * samples[j];
+                job.error = GetADPCMError(output, samples, sample_count);
+                job.error_exhaustive = GetADPCMError(exhaustive.data(), samples, sample_count);
+            }
+        });
+
+        for (auto &job : encode_jobs)
+        {
+            auto &channel = vag_channels[job.channel];
+            channel.signal += job.signal;
+            channel.error += job.error;
+            channel.error_exhaustive += job.error_exhaustive;
+        }
+
+        //Measure the loudness of what was encoded (or reused), before the loop flags go in
+        RunParallel(vag_channels.size(), [&](size_t i) {
+            auto &channel = vag_channels[i];
+            size_t num_samples = channel.adpcm.size() / block_length * block_samples;
+
+            std::vector<int16_t> decoded(num_samples);
+            DecodeADPCM(channel.adpcm.data(), decoded.data(), num_samples, channel.decode_prev);
+            channel.loudness.Feed(decoded.data(), num_samples);
+        });
+
+        //Write the window to the cache and the vag file, window_length being at the stream's sample rate
+        size_t window_length = 0;
         for (auto &channel : vag_channels)
         {
-            int length = (int)channel.adpcm.size() - (int)offset;
-            length = std::min(std::max(length, 0), (int)buffer_size);
+            if (channel.cache_out.is_open())
+                channel.cache_out.write((const char*)channel.adpcm.data(), channel.adpcm.size());
+            window_length = std::max(window_length, channel.adpcm.size() * channel.divider);
+        }
+        if (!window_length)
+            break;
+        max_length = window_block * block_length + window_length;
 
-            if (length) {
-                channel.adpcm[offset + length - (spu::BLOCK_LENGTH - 1)] = 0x03; // add loop flag
-                stream_vag.write((const char*) &(channel.adpcm[offset]), length);
+        size_t num_chunks = (window_length + (buffer_size - 1)) / buffer_size;
+        for (size_t i = 0; i < num_chunks; i++)
+        {
+            //Write chunk buffers
+            for (auto &channel : vag_channels)
+            {
+                int channel_size = buffer_size / channel.divider;
+                size_t offset = i * channel_size;
+
+                int length = (int)channel.adpcm.size() - (int)offset;
+                length = std::min(std::max(length, 0), channel_size);
+
+                if (length) {
+                    channel.adpcm[offset + length - (block_length - 1)] = 0x03; // add loop flag
+                    stream_vag.write((const char*) &(channel.adpcm[offset]), length);
+                }
+
+                for (int k = channel_size - length; k; k--) // pad chunk
+                    stream_vag.put(0);
             }
+        }
+    }
+
+    //Delete miniaudio decoders
+    for (auto &audio : audio_files)
+        ma_decoder_uninit(&audio->decoder);
 
-            for (int k = buffer_size - length; k; k--) // pad chunk
-                stream_vag.put(0);
+    //Move finished cache entries into place, a failed or interrupted build never leaves a truncated entry behind
+    for (auto &channel : vag_channels)
+    {
+        if (!channel.cache_out.is_open())
+            continue;
+        channel.cache_out.close();
+
+        std::error_code error;
+        if (channel.cache_out.fail())
+            std::filesystem::remove(channel.cache_path + ".tmp", error);
+        else
+            std::filesystem::rename(channel.cache_path + ".tmp", channel.cache_path, error);
+    }
+
+    //Report how much quality --fast lost on the ranges that were also encoded exhaustively
+    if (fast)
+    {
+        for (auto &channel : vag_channels)
+        {
+            if (!channel.error || !channel.error_exhaustive)
+                continue;
+
+            double snr = 10.0 * std::log10((double)channel.signal / channel.error);
+            double snr_exhaustive = 10.0 * std::log10((double)channel.signal / channel.error_exhaustive);
+            std::cout << "  " << channel.path << " [L=" << channel.use_l << ", R=" << channel.use_r << "]: "
+                      << std::fixed << std::setprecision(2) << snr << "dB SNR, " << (snr_exhaustive - snr) << "dB below exhaustive"
+                      << std::defaultfloat << std::endl;
         }
     }
+
+    //Turn the song down to the target loudness, measured over all channels as if they all played at once
+    //Every channel gets the same gain so the mix between them stays the same
+    std::vector<double> song_sub_blocks;
+    for (auto &channel : vag_channels)
+    {
+        auto &sub_blocks = channel.loudness.sub_blocks;
+        song_sub_blocks.resize(std::max(song_sub_blocks.size(), sub_blocks.size()));
+        for (size_t i = 0; i < sub_blocks.size(); i++)
+            song_sub_blocks[i] += sub_blocks[i];
+
+        std::cout << "  " << channel.path << " [L=" << channel.use_l << ", R=" << channel.use_r << "]: "
+                  << std::fixed << std::setprecision(1) << GetIntegratedLoudness(sub_blocks) << " LUFS, "
+                  << 20.0 * std::log10(std::max(channel.loudness.peak, 1) / 32768.0) << " dBFS peak"
+                  << std::defaultfloat << std::endl;
+    }
+
+    double song_loudness = GetIntegratedLoudness(song_sub_blocks);
+    double gain = std::min(std::pow(10.0, (target_loudness - song_loudness) / 20.0), 1.0);
+    uint16_t gain_fixed = (uint16_t)std::lround(gain * 0x1000);
+    std::cout << "  Song: " << std::fixed << std::setprecision(1) << song_loudness << " LUFS, gain "
+              << 20.0 * std::log10(gain) << " dB" << std::defaultfloat << std::endl;
+
+    //Write meta header
+    memcpy(&header[0x0], "VAGi", 4);
+    write_int32_big(&header[0x4], 0x20); // version
+    write_int32_little(&header[0x8], buffer_size); // buffer size
+    write_int32_big(&header[0xc], max_length); // size of audio data  for each channel
+    write_int32_big(&header[0x10], sample_rate); // sample rate
+    write_int16_little(&header[0x14], VAG_FLAG_GAIN | VAG_FLAG_PITCH | VAG_FLAG_ROLE); // flags
+    memset(&header[0x16], 0, 8);
+    write_int16_little(&header[0x1e], vag_channels.size()); // channels
+    strncpy((char*)&header[0x20], path_vag.c_str(), 16); // file name
+    for (size_t i = 0; i < vag_channels.size(); i++)
+    {
+        write_int16_little(&header[0x30 + i * 2], gain_fixed); // gain table
+        write_int16_little(&header[0x60 + i * 2], 0x1000 / vag_channels[i].divider); // pitch table
+        header[0x90 + i] = vag_channels[i].role | (vag_channels[i].pan << 4); // role table
+    }
+
+    stream_vag.seekp(0);
+    stream_vag.write((const char*)header, 2048);
     
     //Close vag file
     stream_vag.close();
@@ -23,6 +23,7 @@ freely, subject to the following restrictions:
 
 #include <assert.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -50,7 +51,7 @@ freely, subject to the following restrictions:
 #define FORMAT_STR2CD 7
 #define FORMAT_SBS2 8
 
-typedef struct {
+typedef struct vid_encoder_state_t {
     int frame_index;
     int frame_data_offset;
     int frame_max_size;
@@ -66,8 +67,21 @@ typedef struct {
     int quant_scale;
     int quant_scale_sum;
     float *dct_block_lists[6];
+    struct vid_encoder_state_t *slices; // One per column of macroblocks
+    struct vid_worker_pool_t *pool; // Threads the slices are encoded on
 } vid_encoder_state_t;
 
+// Bounded queue handing data from one decoding thread to the next
+typedef struct {
+    void **items;
+    int capacity;
+    int first;
+    int count;
+    bool closed;
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+} av_queue_t;
+
 typedef struct {
     int video_frame_dst_size;
     int audio_stream_index;
@@ -84,11 +98,20 @@ typedef struct {
     int sample_count_mul;
 
     double video_next_pts;
+
+    // Packets are decoded on one thread and converted by libswscale and
+    // libswresample on another, ahead of the encoder asking for them.
+    av_queue_t decoded_frames;
+    av_queue_t converted_frames;
+    pthread_t decode_thread;
+    pthread_t convert_thread;
+    bool threads_started;
 } av_decoder_state_t;
 
 typedef struct {
     bool quiet;
     bool show_progress;
+    int threads;
 
     int format; // FORMAT_*
     int channels;
@@ -100,12 +123,19 @@ typedef struct {
     int interleave;
     int alignment;
     bool loop;
+    psx_audio_adpcm_quality_t quality;
 
     int video_width;
     int video_height;
     int video_fps_num; // FPS numerator
     int video_fps_den; // FPS denominator
     bool ignore_aspect_ratio;
+    bool two_pass;
+    int max_mdec_words; // 0 = no limit
+
+    int data_sectors; // Per second, taken from the video sectors of str2
+    uint8_t *data;
+    size_t data_size;
 
     char *swresample_options;
     char *swscale_options;
@@ -143,4 +173,5 @@ void encode_file_sbs(settings_t *settings, FILE *output);
 
 // mdec.c
 void encode_frame_bs(uint8_t *video_frame, settings_t *settings);
+void free_frame_bs(settings_t *settings);
 void encode_sector_str(uint8_t *video_frames, uint8_t *output, settings_t *settings);
@@ -24,25 +24,96 @@ freely, subject to the following restrictions:
 
 #include "common.h"
 
-int decode_frame(AVCodecContext *codec, AVFrame *frame, int *frame_size, AVPacket *packet) {
-	int ret;
+#define AV_QUEUE_SIZE 16
+
+// A decoded frame, then the data converted from it
+typedef struct {
+	bool is_video;
+	AVFrame *frame;
+	uint8_t *data; // NV21 frame or S16 samples
+	int sample_count;
+	double pts;
+} av_chunk_t;
+
+static void init_queue(av_queue_t *queue, int capacity)
+{
+	queue->items = malloc(capacity * sizeof(void *));
+	queue->capacity = capacity;
+	queue->first = 0;
+	queue->count = 0;
+	queue->closed = false;
+	pthread_mutex_init(&(queue->mutex), NULL);
+	pthread_cond_init(&(queue->changed), NULL);
+}
 
-	if (packet != NULL) {
-		ret = avcodec_send_packet(codec, packet);
-		if (ret != 0) {
-			return 0;
-		}
+// Waits for space in the queue, returns false if it has been closed.
+static bool push_queue(av_queue_t *queue, void *item)
+{
+	pthread_mutex_lock(&(queue->mutex));
+	while (queue->count == queue->capacity && !queue->closed) {
+		pthread_cond_wait(&(queue->changed), &(queue->mutex));
 	}
 
-	ret = avcodec_receive_frame(codec, frame);
-	if (ret >= 0) {
-		*frame_size = ret;
-		return 1;
-	} else {
-		return ret == AVERROR(EAGAIN) ? 1 : 0;
+	bool ok = !queue->closed;
+	if (ok) {
+		queue->items[(queue->first + queue->count) % queue->capacity] = item;
+		queue->count++;
+		pthread_cond_broadcast(&(queue->changed));
 	}
+	pthread_mutex_unlock(&(queue->mutex));
+	return ok;
 }
 
+// Waits for an item, returns NULL once the queue is closed and empty.
+static void *pop_queue(av_queue_t *queue)
+{
+	pthread_mutex_lock(&(queue->mutex));
+	while (queue->count == 0 && !queue->closed) {
+		pthread_cond_wait(&(queue->changed), &(queue->mutex));
+	}
+
+	void *item = NULL;
+	if (queue->count) {
+		item = queue->items[queue->first];
+		queue->first = (queue->first + 1) % queue->capacity;
+		queue->count--;
+		pthread_cond_broadcast(&(queue->changed));
+	}
+	pthread_mutex_unlock(&(queue->mutex));
+	return item;
+}
+
+static void close_queue(av_queue_t *queue)
+{
+	pthread_mutex_lock(&(queue->mutex));
+	queue->closed = true;
+	pthread_cond_broadcast(&(queue->changed));
+	pthread_mutex_unlock(&(queue->mutex));
+}
+
+static void free_chunk(av_chunk_t *chunk)
+{
+	av_frame_free(&(chunk->frame));
+	free(chunk->data);
+	free(chunk);
+}
+
+static void free_queue(av_queue_t *queue)
+{
+	av_chunk_t *chunk;
+	while ((chunk = pop_queue(queue)) != NULL) {
+		free_chunk(chunk);
+	}
+
+	free(queue->items);
+	pthread_mutex_destroy(&(queue->mutex));
+	pthread_cond_destroy(&(queue->changed));
+}
+
+static void *decode_thread(void *arg);
+static void *convert_thread(void *arg);
+
+
 bool open_av_data(const char *filename, settings_t *settings, bool use_audio, bool use_video, bool audio_required, bool video_required)
 {
 	av_decoder_state_t* av = &(settings->decoder_state_av);
@@ -165,6 +236,9 @@ bool open_av_data(const char *filename, settings_t *settings, bool use_audio, bo
 		if (avcodec_parameters_to_context(av->video_codec_context, av->video_stream->codecpar) < 0) {
 			return false;
 		}
+		// Let libavcodec decode several frames at once.
+		av->video_codec_context->thread_count = settings->threads;
+		av->video_codec_context->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
 		if (avcodec_open2(av->video_codec_context, codec, NULL) < 0) {
 			return false;
 		}
@@ -240,107 +314,209 @@ bool open_av_data(const char *filename, settings_t *settings, bool use_audio, bo
 	settings->video_frame_count = 0;
 	settings->end_of_input = false;
 
+	init_queue(&(av->decoded_frames), AV_QUEUE_SIZE);
+	init_queue(&(av->converted_frames), AV_QUEUE_SIZE);
+	if (pthread_create(&(av->decode_thread), NULL, decode_thread, settings)) {
+		return false;
+	}
+	if (pthread_create(&(av->convert_thread), NULL, convert_thread, settings)) {
+		close_queue(&(av->decoded_frames));
+		pthread_join(av->decode_thread, NULL);
+		return false;
+	}
+	av->threads_started = true;
+
 	return true;
 }
 
-static void poll_av_packet_audio(settings_t *settings, AVPacket *packet)
+static bool convert_audio(settings_t *settings, av_chunk_t *chunk)
 {
 	av_decoder_state_t* av = &(settings->decoder_state_av);
+	AVFrame *frame = chunk->frame;
 
-	int frame_size, frame_sample_count;
-	uint8_t *buffer[1];
-
-	if (decode_frame(av->audio_codec_context, av->frame, &frame_size, packet)) {
-		size_t buffer_size = sizeof(int16_t) * av->sample_count_mul * swr_get_out_samples(av->resampler, av->frame->nb_samples);
-		buffer[0] = malloc(buffer_size);
-		memset(buffer[0], 0, buffer_size);
-		frame_sample_count = swr_convert(av->resampler, buffer, av->frame->nb_samples, (const uint8_t**)av->frame->data, av->frame->nb_samples);
-		settings->audio_samples = realloc(settings->audio_samples, (settings->audio_sample_count + ((frame_sample_count + 4032) * av->sample_count_mul)) * sizeof(int16_t));
-		memmove(&(settings->audio_samples[settings->audio_sample_count]), buffer[0], sizeof(int16_t) * frame_sample_count * av->sample_count_mul);
-		settings->audio_sample_count += frame_sample_count * av->sample_count_mul;
-		free(buffer[0]);
-	}
+	size_t buffer_size = sizeof(int16_t) * av->sample_count_mul * swr_get_out_samples(av->resampler, frame->nb_samples);
+	chunk->data = malloc(buffer_size);
+	memset(chunk->data, 0, buffer_size);
+	chunk->sample_count = swr_convert(av->resampler, &(chunk->data), frame->nb_samples, (const uint8_t**)frame->data, frame->nb_samples);
+	return true;
 }
 
-static void poll_av_packet_video(settings_t *settings, AVPacket *packet)
+static bool convert_video(settings_t *settings, av_chunk_t *chunk)
 {
 	av_decoder_state_t* av = &(settings->decoder_state_av);
-
-	int frame_size;
-	double pts_step = ((double)1.0*(double)settings->video_fps_den)/(double)settings->video_fps_num;
+	AVFrame *frame = chunk->frame;
 
 	int plane_size = settings->video_width*settings->video_height;
 	int dst_strides[2] = {
 		settings->video_width, settings->video_width
 	};
 
-	if (decode_frame(av->video_codec_context, av->frame, &frame_size, packet)) {
-		if (!av->frame->width || !av->frame->height || !av->frame->data[0]) {
-			return;
-		}
+	if (!frame->width || !frame->height || !frame->data[0]) {
+		return false;
+	}
+
+	chunk->pts = (((double)frame->pts)*(double)av->video_stream->time_base.num)/av->video_stream->time_base.den;
+	chunk->data = malloc(av->video_frame_dst_size);
+
+	uint8_t *dst_pointers[2] = {
+		chunk->data, chunk->data + plane_size
+	};
+	sws_scale(av->scaler, (const uint8_t *const *) frame->data, frame->linesize, 0, frame->height, dst_pointers, dst_strides);
+	return true;
+}
+
+// Sends a packet to the decoder (or flushes it if packet is NULL) and queues
+// every frame it hands back, as a packet can result in any number of frames
+// (none while frame threading holds them back, several once it catches up).
+// Returns false if the encoder stopped taking frames.
+static bool decode_packet(settings_t *settings, AVCodecContext *codec, AVPacket *packet)
+{
+	av_decoder_state_t* av = &(settings->decoder_state_av);
+
+	if (avcodec_send_packet(codec, packet) != 0) {
+		return true;
+	}
+
+	while (avcodec_receive_frame(codec, av->frame) >= 0) {
+		av_chunk_t *chunk = calloc(1, sizeof(av_chunk_t));
+		chunk->is_video = (codec == av->video_codec_context);
+		chunk->frame = av_frame_alloc();
+		av_frame_move_ref(chunk->frame, av->frame);
 
-		// Some files seem to have timestamps starting from a negative value
-		// (but otherwise valid) for whatever reason.
-		double pts = (((double)av->frame->pts)*(double)av->video_stream->time_base.num)/av->video_stream->time_base.den;
-		//if (pts < 0.0) {
-			//return;
-		//}
-		if (settings->video_frame_count >= 1 && pts < av->video_next_pts) {
-			return;
+		if (!push_queue(&(av->decoded_frames), chunk)) {
+			free_chunk(chunk);
+			return false;
 		}
-		if ((settings->video_frame_count) < 1) {
-			av->video_next_pts = pts;
-		} else {
-			av->video_next_pts += pts_step;
+	}
+	return true;
+}
+
+static void *decode_thread(void *arg)
+{
+	settings_t *settings = (settings_t *)arg;
+	av_decoder_state_t* av = &(settings->decoder_state_av);
+	AVPacket packet;
+	bool ok = true;
+
+	while (ok && av_read_frame(av->format, &packet) >= 0) {
+		if (packet.stream_index == av->audio_stream_index) {
+			ok = decode_packet(settings, av->audio_codec_context, &packet);
+		} else if (packet.stream_index == av->video_stream_index) {
+			ok = decode_packet(settings, av->video_codec_context, &packet);
 		}
+		av_packet_unref(&packet);
+	}
 
-		//fprintf(stderr, "%d %f %f %f\n", (settings->video_frame_count), pts, av->video_next_pts, pts_step);
+	// Drain the frames the decoders are still holding on to.
+	if (ok && av->video_codec_context != NULL) {
+		ok = decode_packet(settings, av->video_codec_context, NULL);
+	}
+	if (ok && av->audio_codec_context != NULL) {
+		decode_packet(settings, av->audio_codec_context, NULL);
+	}
 
-		// Insert duplicate frames if the frame rate of the input stream is
-		// lower than the target frame rate.
-		int dupe_frames = (int) ceil((pts - av->video_next_pts) / pts_step);
-		if (dupe_frames < 0) dupe_frames = 0;
-		settings->video_frames = realloc(
-			settings->video_frames,
-			(settings->video_frame_count + dupe_frames + 1) * av->video_frame_dst_size
-		);
+	close_queue(&(av->decoded_frames));
+	return NULL;
+}
 
-		for (; dupe_frames; dupe_frames--) {
-			memcpy(
-				(settings->video_frames) + av->video_frame_dst_size*(settings->video_frame_count),
-				(settings->video_frames) + av->video_frame_dst_size*(settings->video_frame_count-1),
-				av->video_frame_dst_size
-			);
-			settings->video_frame_count += 1;
-			av->video_next_pts += pts_step;
+// Frames have to be converted in order, as libswresample keeps state
+// between them.
+static void *convert_thread(void *arg)
+{
+	settings_t *settings = (settings_t *)arg;
+	av_decoder_state_t* av = &(settings->decoder_state_av);
+	av_chunk_t *chunk;
+
+	while ((chunk = pop_queue(&(av->decoded_frames))) != NULL) {
+		bool keep = chunk->is_video ? convert_video(settings, chunk) : convert_audio(settings, chunk);
+		av_frame_free(&(chunk->frame));
+
+		if (!keep) {
+			free_chunk(chunk);
+		} else if (!push_queue(&(av->converted_frames), chunk)) {
+			free_chunk(chunk);
+			break;
 		}
+	}
 
-		uint8_t *dst_frame = (settings->video_frames) + av->video_frame_dst_size*(settings->video_frame_count);
-		uint8_t *dst_pointers[2] = {
-			dst_frame, dst_frame + plane_size
-		};
-		sws_scale(av->scaler, (const uint8_t *const *) av->frame->data, av->frame->linesize, 0, av->frame->height, dst_pointers, dst_strides);
+	close_queue(&(av->converted_frames));
+	return NULL;
+}
 
+static void poll_av_chunk_audio(settings_t *settings, av_chunk_t *chunk)
+{
+	av_decoder_state_t* av = &(settings->decoder_state_av);
+
+	int frame_sample_count = chunk->sample_count;
+	settings->audio_samples = realloc(settings->audio_samples, (settings->audio_sample_count + ((frame_sample_count + 4032) * av->sample_count_mul)) * sizeof(int16_t));
+	memmove(&(settings->audio_samples[settings->audio_sample_count]), chunk->data, sizeof(int16_t) * frame_sample_count * av->sample_count_mul);
+	settings->audio_sample_count += frame_sample_count * av->sample_count_mul;
+}
+
+static void poll_av_chunk_video(settings_t *settings, av_chunk_t *chunk)
+{
+	av_decoder_state_t* av = &(settings->decoder_state_av);
+
+	double pts_step = ((double)1.0*(double)settings->video_fps_den)/(double)settings->video_fps_num;
+
+	// Some files seem to have timestamps starting from a negative value
+	// (but otherwise valid) for whatever reason.
+	double pts = chunk->pts;
+	//if (pts < 0.0) {
+		//return;
+	//}
+	if (settings->video_frame_count >= 1 && pts < av->video_next_pts) {
+		return;
+	}
+	if ((settings->video_frame_count) < 1) {
+		av->video_next_pts = pts;
+	} else {
+		av->video_next_pts += pts_step;
+	}
+
+	//fprintf(stderr, "%d %f %f %f\n", (settings->video_frame_count), pts, av->video_next_pts, pts_step);
+
+	// Insert duplicate frames if the frame rate of the input stream is
+	// lower than the target frame rate.
+	int dupe_frames = (int) ceil((pts - av->video_next_pts) / pts_step);
+	if (dupe_frames < 0) dupe_frames = 0;
+	settings->video_frames = realloc(
+		settings->video_frames,
+		(settings->video_frame_count + dupe_frames + 1) * av->video_frame_dst_size
+	);
+
+	for (; dupe_frames; dupe_frames--) {
+		memcpy(
+			(settings->video_frames) + av->video_frame_dst_size*(settings->video_frame_count),
+			(settings->video_frames) + av->video_frame_dst_size*(settings->video_frame_count-1),
+			av->video_frame_dst_size
+		);
 		settings->video_frame_count += 1;
+		av->video_next_pts += pts_step;
 	}
+
+	uint8_t *dst_frame = (settings->video_frames) + av->video_frame_dst_size*(settings->video_frame_count);
+	memcpy(dst_frame, chunk->data, av->video_frame_dst_size);
+
+	settings->video_frame_count += 1;
 }
 
 bool poll_av_data(settings_t *settings)
 {
 	av_decoder_state_t* av = &(settings->decoder_state_av);
-	AVPacket packet;
 
 	if (settings->end_of_input) {
 		return false;
 	}
 
-	if (av_read_frame(av->format, &packet) >= 0) {
-		if (packet.stream_index == av->audio_stream_index) {
-			poll_av_packet_audio(settings, &packet);
-		} else if (packet.stream_index == av->video_stream_index) {
-			poll_av_packet_video(settings, &packet);
+	av_chunk_t *chunk = pop_queue(&(av->converted_frames));
+	if (chunk != NULL) {
+		if (chunk->is_video) {
+			poll_av_chunk_video(settings, chunk);
+		} else {
+			poll_av_chunk_audio(settings, chunk);
 		}
-		av_packet_unref(&packet);
+		free_chunk(chunk);
 		return true;
 	} else {
 		// out is always padded out with 4032 "0" samples, this makes calculations elsewhere easier
@@ -394,6 +570,17 @@ void close_av_data(settings_t *settings)
 {
 	av_decoder_state_t* av = &(settings->decoder_state_av);
 
+	// Stop the decoding threads in case the encoder didn't read everything.
+	if (av->threads_started) {
+		close_queue(&(av->decoded_frames));
+		close_queue(&(av->converted_frames));
+		pthread_join(av->decode_thread, NULL);
+		pthread_join(av->convert_thread, NULL);
+		free_queue(&(av->decoded_frames));
+		free_queue(&(av->converted_frames));
+		av->threads_started = false;
+	}
+
 	av_frame_free(&(av->frame));
 	swr_free(&(av->resampler));
 	avcodec_close(av->audio_codec_context);
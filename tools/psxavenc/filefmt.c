@@ -106,6 +106,7 @@ void encode_file_spu(settings_t *settings, FILE *output) {
     int block_count;
 
     memset(&audio_state, 0, sizeof(psx_audio_encoder_channel_state_t));
+    audio_state.quality = settings->quality;
 
     // The header must be written after the data as we don't yet know the
     // number of audio samples.
@@ -167,6 +168,9 @@ void encode_file_spu_interleaved(settings_t *settings, FILE *output) {
     int chunk_count;
 
     memset(audio_state, 0, audio_state_size);
+    for (int ch = 0; ch < settings->channels; ch++) {
+        audio_state[ch].quality = settings->quality;
+    }
 
     if (settings->format == FORMAT_VAGI) {
         fseek(output, header_size, SEEK_SET);
@@ -223,6 +227,8 @@ void encode_file_xa(settings_t *settings, FILE *output) {
     uint8_t buffer[2352];
 
     memset(&audio_state, 0, sizeof(psx_audio_encoder_state_t));
+    audio_state.left.quality = settings->quality;
+    audio_state.right.quality = settings->quality;
 
     for (int j = 0; ensure_av_data(settings, audio_samples_per_sector*settings->channels, 0); j++) {
         int samples_length = settings->audio_sample_count / settings->channels;
@@ -254,6 +260,45 @@ void encode_file_xa(settings_t *settings, FILE *output) {
     }
 }
 
+// Data sectors use the same header as video sectors, with chunk type 0x8002
+// and the total data size in place of the frame size. Once the whole file has
+// been sent it is sent again from the start, so a player that missed a sector
+// gets another chance. Spare ones (no file given) have a chunk count of 0.
+static void encode_sector_str_data(uint8_t *output, settings_t *settings, int data_index) {
+    uint8_t *sector = output + ((settings->format == FORMAT_STR2CD) ? 0x018 : 0x008);
+    int chunk_count = (int)((settings->data_size + 2015) / 2016);
+
+    // STR version
+    sector[0x000] = 0x60;
+    sector[0x001] = 0x01;
+
+    // Chunk type: data
+    sector[0x002] = 0x02;
+    sector[0x003] = 0x80;
+
+    if (chunk_count == 0) {
+        return;
+    }
+    int chunk_index = data_index % chunk_count;
+
+    // Chunk index/count
+    sector[0x004] = (uint8_t)chunk_index;
+    sector[0x005] = (uint8_t)(chunk_index>>8);
+    sector[0x006] = (uint8_t)chunk_count;
+    sector[0x007] = (uint8_t)(chunk_count>>8);
+
+    // Data size
+    sector[0x00C] = (uint8_t)settings->data_size;
+    sector[0x00D] = (uint8_t)(settings->data_size>>8);
+    sector[0x00E] = (uint8_t)(settings->data_size>>16);
+    sector[0x00F] = (uint8_t)(settings->data_size>>24);
+
+    size_t offset = (size_t)chunk_index * 2016;
+    size_t length = settings->data_size - offset;
+    if (length > 2016) length = 2016;
+    memcpy(sector + 0x020, settings->data + offset, length);
+}
+
 void encode_file_str(settings_t *settings, FILE *output) {
     psx_audio_xa_settings_t xa_settings = settings_to_libpsxav_xa_audio(settings);
     psx_audio_encoder_state_t audio_state;
@@ -280,10 +325,37 @@ void encode_file_str(settings_t *settings, FILE *output) {
             interleave - video_sectors_per_block, interleave, video_sectors_per_block, interleave);
     }
 
+    // Data sectors replace some of the video sectors, spread out evenly so
+    // that data_sectors of them come up every second.
+    int data_slot_den = 75 * settings->cd_speed * video_sectors_per_block;
+    int data_slot_num = settings->data_sectors * interleave;
+
+    // Every frame needs at least one sector.
+    int max_data_sectors = (data_slot_den * settings->video_fps_den - interleave * settings->video_fps_num) / (interleave * settings->video_fps_den);
+    if (max_data_sectors < 0) max_data_sectors = 0;
+    if (settings->data_sectors > max_data_sectors) {
+        settings->data_sectors = max_data_sectors;
+        data_slot_num = settings->data_sectors * interleave;
+        fprintf(stderr, "Warning: reducing data sectors to %d per second to leave room for video\n", settings->data_sectors);
+    }
+    int data_slot_overflow = 0;
+    int data_chunk_index = 0;
+    int data_chunk_count = (int)((settings->data_size + 2015) / 2016);
+    if (!settings->quiet && settings->data_sectors) {
+        fprintf(stderr, "Data: %d sectors per second", settings->data_sectors);
+        if (settings->data_size) {
+            fprintf(stderr, ", %zu bytes received after %.2f seconds",
+                settings->data_size, (double)data_chunk_count / (double)settings->data_sectors);
+        }
+        fprintf(stderr, "\n");
+    }
+
     memset(&audio_state, 0, sizeof(psx_audio_encoder_state_t));
+    audio_state.left.quality = settings->quality;
+    audio_state.right.quality = settings->quality;
 
     // e.g. 15fps = (150*7/8/15) = 8.75 blocks per frame
-    settings->state_vid.frame_block_base_overflow = (75*settings->cd_speed) * video_sectors_per_block * settings->video_fps_den;
+    settings->state_vid.frame_block_base_overflow = ((75*settings->cd_speed) * video_sectors_per_block - data_slot_num) * settings->video_fps_den;
     settings->state_vid.frame_block_overflow_den = interleave * settings->video_fps_num;
     double frame_size = (double)settings->state_vid.frame_block_base_overflow / (double)settings->state_vid.frame_block_overflow_den;
     if (!settings->quiet) {
@@ -305,9 +377,16 @@ void encode_file_str(settings_t *settings, FILE *output) {
         ensure_av_data(settings, audio_samples_per_sector*settings->channels, frames_needed);
 
         if ((j%interleave) < video_sectors_per_block) {
-            // Video sector
+            // Video or data sector
             init_sector_buffer_video(buffer, settings);
-            encode_sector_str(settings->video_frames, buffer, settings);
+
+            data_slot_overflow += data_slot_num;
+            if (data_slot_overflow >= data_slot_den) {
+                data_slot_overflow -= data_slot_den;
+                encode_sector_str_data(buffer, settings, data_chunk_index++);
+            } else {
+                encode_sector_str(settings->video_frames, buffer, settings);
+            }
         } else {
             // Audio sector
             int samples_length = settings->audio_sample_count / settings->channels;
@@ -355,6 +434,14 @@ void encode_file_str(settings_t *settings, FILE *output) {
         }
     }
 
+    if (data_chunk_index < data_chunk_count) {
+        fprintf(stderr, "\nWarning: video too short for the data, only %d of %d sectors stored\n",
+            data_chunk_index, data_chunk_count);
+    } else if (!settings->quiet && data_chunk_count) {
+        fprintf(stderr, "\nData sent %.2f times\n", (double)data_chunk_index / (double)data_chunk_count);
+    }
+
+    free_frame_bs(settings);
     free(settings->state_vid.frame_output);
 }
 
@@ -378,5 +465,6 @@ void encode_file_sbs(settings_t *settings, FILE *output) {
         }
     }
 
+    free_frame_bs(settings);
     free(settings->state_vid.frame_output);
 }
@@ -26,6 +26,14 @@ freely, subject to the following restrictions:
 #include <string.h>
 #include "libpsxav.h"
 
+// The filter search uses SSE2 wherever it's guaranteed to be available (i.e.
+// all x86-64 targets). Define LIBPSXAV_NO_SIMD to force the scalar search,
+// which the SSE2 one must always match bit-for-bit.
+#if !defined(LIBPSXAV_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define ADPCM_SSE2
+#include <emmintrin.h>
+#endif
+
 #define SHIFT_RANGE_4BPS 12
 #define SHIFT_RANGE_8BPS 8
 
@@ -120,45 +128,302 @@ static uint8_t attempt_to_encode(psx_audio_encoder_channel_state_t *outstate, co
 	return hdr;
 }
 
+#define MAX_CANDIDATES 16
+
+// Number of filters PSX_AUDIO_ADPCM_FAST picks by their predicted error (on
+// top of the one used by the previous block).
+#define FAST_FILTER_COUNT 2
+
+// Guesses which filters will work best for a block without encoding it,
+// returning them as a bitmask. The squared prediction error of each filter
+// follows from the block's autocorrelation at lags 0-2 (i.e. its spectral
+// slope): sum((x[n] - (k1*x[n-1] + k2*x[n-2])/64)^2), expanded out. The
+// filter the previous block used is always kept as signals tend to change
+// slowly, and the quantization error isn't accounted for.
+static int predict_filters(const psx_audio_encoder_channel_state_t *state, const int16_t *samples, int filter_count) {
+	int64_t s00 = 0, s01 = 0, s02 = 0, s11 = 0, s12 = 0, s22 = 0;
+	int prev1 = state->prev1;
+	int prev2 = state->prev2;
+
+	for (int i = 0; i < 28; i++) {
+		int64_t x = samples[i];
+		s00 += x * x;
+		s01 += x * prev1;
+		s02 += x * prev2;
+		s11 += (int64_t)prev1 * prev1;
+		s12 += (int64_t)prev1 * prev2;
+		s22 += (int64_t)prev2 * prev2;
+		prev2 = prev1;
+		prev1 = x;
+	}
+
+	int64_t error[ADPCM_FILTER_COUNT];
+	for (int filter = 0; filter < filter_count; filter++) {
+		int64_t k1 = filter_k1[filter];
+		int64_t k2 = filter_k2[filter];
+		error[filter] = (s00 << 12) - ((k1*s01 + k2*s02) << 7) + k1*k1*s11 + 2*k1*k2*s12 + k2*k2*s22;
+	}
+
+	int mask = 0;
+	for (int n = 0; n < FAST_FILTER_COUNT && n < filter_count; n++) {
+		int best = -1;
+		for (int filter = 0; filter < filter_count; filter++) {
+			if (mask & (1 << filter)) { continue; }
+			if (best < 0 || error[filter] < error[best]) { best = filter; }
+		}
+		mask |= 1 << best;
+	}
+	if (state->prev_filter < filter_count) { mask |= 1 << state->prev_filter; }
+	return mask;
+}
+
+#ifdef ADPCM_SSE2
+// Low 32 bits of a 32x32-bit multiplication (SSE2 lacks _mm_mullo_epi32()).
+static inline __m128i mullo32(__m128i a, __m128i b) {
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+
+	return _mm_unpacklo_epi32(
+		_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+		_mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0))
+	);
+}
+
+// find_min_shift() for filters 1-4 at once, one per 32-bit lane (filter 0 is
+// left to find_min_shift() as it has no previous values to compute).
+static void find_min_shifts_sse2(const psx_audio_encoder_channel_state_t *state, const int16_t *samples, int shift_range, int *min_shifts) {
+	const __m128i coeff = _mm_setr_epi32(
+		(filter_k1[1] & 0xFFFF) | (filter_k2[1] << 16),
+		(filter_k1[2] & 0xFFFF) | (filter_k2[2] << 16),
+		(filter_k1[3] & 0xFFFF) | (filter_k2[3] << 16),
+		(filter_k1[4] & 0xFFFF) | (filter_k2[4] << 16)
+	);
+	const __m128i filter_round = _mm_set1_epi32(1<<5);
+	__m128i prev = _mm_set1_epi32((state->prev1 & 0xFFFF) | (state->prev2 << 16));
+	__m128i s_min = _mm_setzero_si128();
+	__m128i s_max = _mm_setzero_si128();
+
+	for (int i = 0; i < 28; i++) {
+		__m128i raw_sample = _mm_set1_epi32(samples[i]);
+		__m128i previous_values = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(prev, coeff), filter_round), 6);
+		__m128i sample = _mm_sub_epi32(raw_sample, previous_values);
+
+		__m128i less = _mm_cmplt_epi32(sample, s_min);
+		s_min = _mm_or_si128(_mm_and_si128(less, sample), _mm_andnot_si128(less, s_min));
+		__m128i greater = _mm_cmpgt_epi32(sample, s_max);
+		s_max = _mm_or_si128(_mm_and_si128(greater, sample), _mm_andnot_si128(greater, s_max));
+
+		prev = _mm_or_si128(_mm_slli_epi32(prev, 16), _mm_set1_epi32(samples[i] & 0xFFFF));
+	}
+
+	int32_t mins[4], maxs[4];
+	_mm_storeu_si128((__m128i *)mins, s_min);
+	_mm_storeu_si128((__m128i *)maxs, s_max);
+	for (int lane = 0; lane < 4; lane++) {
+		int right_shift = 0;
+		while(right_shift < shift_range && (maxs[lane]>>right_shift) > (+0x7FFF >> shift_range)) { right_shift += 1; };
+		while(right_shift < shift_range && (mins[lane]>>right_shift) < (-0x8000 >> shift_range)) { right_shift += 1; };
+		min_shifts[lane + 1] = shift_range - right_shift;
+	}
+}
+
+// 4-bit only version of attempt_to_encode() which tries up to 16 candidate
+// filter/shift pairs at once, one per 32-bit lane, returning the error, the
+// encoded samples and the final previous samples (prev1 | prev2 << 16) of
+// each. The previous samples of each lane are kept as a pair of 16-bit values
+// so the filter is a single _mm_madd_epi16(), and the squared errors are
+// summed in 64 bits so they match attempt_to_encode() exactly.
+static void attempt_to_encode_sse2(const psx_audio_encoder_channel_state_t *state, const int16_t *samples, const int *filters, const int *sample_shifts, int candidate_count, uint64_t *mse, int16_t encoded[28][MAX_CANDIDATES], int32_t *prev_out) {
+	__m128i coeffs[MAX_CANDIDATES / 4], scales[MAX_CANDIDATES / 4], expands[MAX_CANDIDATES / 4];
+	__m128i prevs[MAX_CANDIDATES / 4], mse_even[MAX_CANDIDATES / 4], mse_odd[MAX_CANDIDATES / 4];
+	int vector_count = (candidate_count + 3) / 4;
+	int prev = (state->prev1 & 0xFFFF) | (state->prev2 << 16);
+
+	// Filters are stored as (k1, k2) pairs, encoding as a multiplication by
+	// 2^shift and decoding as one by 2^(12 - shift). Unused lanes just repeat
+	// the first candidate.
+	for (int v = 0; v < vector_count; v++) {
+		int32_t coeff[4], scale[4], expand[4];
+		for (int lane = 0; lane < 4; lane++) {
+			int i = v * 4 + lane;
+			if (i >= candidate_count) { i = 0; }
+			coeff[lane] = (filter_k1[filters[i]] & 0xFFFF) | (filter_k2[filters[i]] << 16);
+			scale[lane] = 1 << sample_shifts[i];
+			expand[lane] = 1 << (SHIFT_RANGE_4BPS - sample_shifts[i]);
+		}
+		coeffs[v] = _mm_setr_epi32(coeff[0], coeff[1], coeff[2], coeff[3]);
+		scales[v] = _mm_setr_epi32(scale[0], scale[1], scale[2], scale[3]);
+		expands[v] = _mm_setr_epi32(expand[0], expand[1], expand[2], expand[3]);
+		prevs[v] = _mm_set1_epi32(prev);
+		mse_even[v] = _mm_setzero_si128();
+		mse_odd[v] = _mm_setzero_si128();
+	}
+
+	const __m128i filter_round = _mm_set1_epi32(1<<5);
+	const __m128i shift_round = _mm_set1_epi32(1<<(SHIFT_RANGE_4BPS-1));
+	const __m128i enc_min = _mm_set1_epi16(-0x8000 >> SHIFT_RANGE_4BPS);
+	const __m128i enc_max = _mm_set1_epi16(+0x7FFF >> SHIFT_RANGE_4BPS);
+	const __m128i low_half = _mm_set1_epi32(0xFFFF);
+
+	for (int i = 0; i < 28; i++) {
+		__m128i sample = _mm_set1_epi32(samples[i]);
+
+		for (int v = 0; v < vector_count; v++) {
+			__m128i previous_values = _mm_madd_epi16(prevs[v], coeffs[v]);
+			previous_values = _mm_srai_epi32(_mm_add_epi32(previous_values, filter_round), 6);
+
+			__m128i sample_enc = mullo32(_mm_sub_epi32(sample, previous_values), scales[v]);
+			sample_enc = _mm_srai_epi32(_mm_add_epi32(sample_enc, shift_round), SHIFT_RANGE_4BPS);
+			sample_enc = _mm_packs_epi32(sample_enc, sample_enc);
+			sample_enc = _mm_max_epi16(_mm_min_epi16(sample_enc, enc_max), enc_min);
+			_mm_storel_epi64((__m128i *)&encoded[i][v * 4], sample_enc);
+
+			// Multiply each (sample_enc, sample_enc) pair by (2^(12 - shift), 0)
+			// and clamp to 16 bits.
+			__m128i sample_dec = _mm_madd_epi16(_mm_unpacklo_epi16(sample_enc, sample_enc), expands[v]);
+			sample_dec = _mm_add_epi32(sample_dec, previous_values);
+			sample_dec = _mm_packs_epi32(sample_dec, sample_dec);
+			sample_dec = _mm_srai_epi32(_mm_unpacklo_epi16(sample_dec, sample_dec), 16);
+
+			// Square the absolute error as unsigned 32-bit values into
+			// 64-bit sums, even and odd lanes separately.
+			__m128i sample_error = _mm_sub_epi32(sample_dec, sample);
+			__m128i sign = _mm_srai_epi32(sample_error, 31);
+			sample_error = _mm_sub_epi32(_mm_xor_si128(sample_error, sign), sign);
+			mse_even[v] = _mm_add_epi64(mse_even[v], _mm_mul_epu32(sample_error, sample_error));
+			sample_error = _mm_srli_epi64(sample_error, 32);
+			mse_odd[v] = _mm_add_epi64(mse_odd[v], _mm_mul_epu32(sample_error, sample_error));
+
+			prevs[v] = _mm_or_si128(_mm_slli_epi32(prevs[v], 16), _mm_and_si128(sample_dec, low_half));
+		}
+	}
+
+	for (int v = 0; v < vector_count; v++) {
+		uint64_t lanes[4];
+		_mm_storeu_si128((__m128i *)&prev_out[v * 4], prevs[v]);
+		_mm_storeu_si128((__m128i *)&lanes[0], _mm_unpacklo_epi64(mse_even[v], mse_odd[v]));
+		_mm_storeu_si128((__m128i *)&lanes[2], _mm_unpackhi_epi64(mse_even[v], mse_odd[v]));
+		for (int lane = 0; lane < 4 && v * 4 + lane < candidate_count; lane++) {
+			mse[v * 4 + lane] = lanes[lane];
+		}
+	}
+}
+#endif
+
 static uint8_t encode(psx_audio_encoder_channel_state_t *state, int16_t *samples, int sample_limit, int pitch, uint8_t *data, int data_shift, int data_pitch, int filter_count, int shift_range) {
-    psx_audio_encoder_channel_state_t proposed;
-	int64_t best_mse = ((int64_t)1<<(int64_t)50);
-	int best_filter = 0;
-	int best_sample_shift = 0;
+	psx_audio_encoder_channel_state_t proposed;
+	int16_t block[28];
+	int filters[MAX_CANDIDATES] = {0};
+	int sample_shifts[MAX_CANDIDATES] = {0};
+	uint64_t mse[MAX_CANDIDATES] = {0};
+	int candidate_count = 0;
+
+	// Gather (and zero pad) the block first so the search doesn't have to
+	// care about the pitch and sample limit.
+	for (int i = 0; i < 28; i++) {
+		block[i] = (i >= sample_limit) ? 0 : samples[i * pitch];
+	}
+
+	int filter_mask = (1 << filter_count) - 1;
+	if (state->quality == PSX_AUDIO_ADPCM_FAST) {
+		filter_mask = predict_filters(state, block, filter_count);
+	}
+	// Always try at least filter 0, so there's a candidate to pick.
+	if (!filter_mask) { filter_mask = 1; }
+
+	int min_shifts[ADPCM_FILTER_COUNT];
+#ifdef ADPCM_SSE2
+	bool simd = shift_range == SHIFT_RANGE_4BPS && !state->qerr;
+	if (simd && (filter_mask & ~1)) {
+		find_min_shifts_sse2(state, block, shift_range, min_shifts);
+	} else
+#endif
+	{
+		for (int filter = 1; filter < filter_count; filter++) {
+			if (filter_mask & (1 << filter)) {
+				min_shifts[filter] = find_min_shift(state, block, 28, 1, filter, shift_range);
+			}
+		}
+	}
+	if (filter_mask & 1) {
+		min_shifts[0] = find_min_shift(state, block, 28, 1, 0, shift_range);
+	}
 
 	for (int filter = 0; filter < filter_count; filter++) {
-		int true_min_shift = find_min_shift(state, samples, sample_limit, pitch, filter, shift_range);
+		if (!(filter_mask & (1 << filter))) { continue; }
+		int true_min_shift = min_shifts[filter];
 
 		// Testing has shown that the optimal shift can be off the true minimum shift
 		// by 1 in *either* direction.
 		// This is NOT the case when dither is used.
 		int min_shift = true_min_shift - 1;
 		int max_shift = true_min_shift + 1;
+		if (state->quality == PSX_AUDIO_ADPCM_FAST) { min_shift = max_shift = true_min_shift; }
 		if (min_shift < 0) { min_shift = 0; }
 		if (max_shift > shift_range) { max_shift = shift_range; }
 
 		for (int sample_shift = min_shift; sample_shift <= max_shift; sample_shift++) {
+			filters[candidate_count] = filter;
+			sample_shifts[candidate_count] = sample_shift;
+			candidate_count++;
+		}
+	}
+
+#ifdef ADPCM_SSE2
+	int16_t encoded[28][MAX_CANDIDATES];
+	int32_t prevs[MAX_CANDIDATES];
+	if (simd) {
+		attempt_to_encode_sse2(state, block, filters, sample_shifts, candidate_count, mse, encoded, prevs);
+	} else
+#endif
+	{
+		for (int i = 0; i < candidate_count; i++) {
 			// ignore header here
 			attempt_to_encode(
 				&proposed, state,
-				samples, sample_limit, pitch,
+				block, 28, 1,
 				data, data_shift, data_pitch,
-				filter, sample_shift, shift_range);
+				filters[i], sample_shifts[i], shift_range);
+			mse[i] = proposed.mse;
+		}
+	}
 
-			if (best_mse > proposed.mse) {
-				best_mse = proposed.mse;
-				best_filter = filter;
-				best_sample_shift = sample_shift;
-			}
+	int64_t best_mse = ((int64_t)1<<(int64_t)50);
+	int best = 0;
+
+	for (int i = 0; i < candidate_count; i++) {
+		if (best_mse > (int64_t)mse[i]) {
+			best_mse = mse[i];
+			best = i;
 		}
 	}
 
+	state->prev_filter = filters[best];
+
+#ifdef ADPCM_SSE2
+	// The SSE2 search already encoded every candidate, so just copy out the
+	// best one instead of encoding it again.
+	if (simd) {
+		uint8_t sample_mask = 0xFFFF >> shift_range;
+		uint8_t nondata_mask = ~(sample_mask << data_shift);
+
+		for (int i = 0; i < 28; i++) {
+			data[i * data_pitch] = (data[i * data_pitch] & nondata_mask) | ((encoded[i][best] & sample_mask) << data_shift);
+		}
+
+		state->mse = mse[best];
+		state->prev1 = (int16_t)(prevs[best] & 0xFFFF);
+		state->prev2 = prevs[best] >> 16;
+		return (sample_shifts[best] & 0x0F) | (filters[best] << 4);
+	}
+#endif
+
 	// now go with the encoder
 	return attempt_to_encode(
 		state, state,
-		samples, sample_limit, pitch,
+		block, 28, 1,
 		data, data_shift, data_pitch,
-		best_filter, best_sample_shift, shift_range);
+		filters[best], sample_shifts[best], shift_range);
 }
 
 static void encode_block_xa(int16_t *audio_samples, int audio_samples_limit, uint8_t *data, psx_audio_xa_settings_t settings, psx_audio_encoder_state_t *state) {
@@ -298,12 +563,13 @@ int psx_audio_xa_encode_simple(psx_audio_xa_settings_t settings, int16_t* sample
 	return length;
 }
 
-int psx_audio_spu_encode(psx_audio_encoder_channel_state_t *state, int16_t* samples, int sample_count, int pitch, uint8_t *output) {
+static int encode_spu(psx_audio_encoder_channel_state_t *state, int16_t* samples, int sample_count, int pitch, uint8_t *output, int first_filter_count) {
 	uint8_t prebuf[28];
 	uint8_t *buffer = output;
 
 	for (int i = 0; i < sample_count; i += 28, buffer += 16) {
-		buffer[0] = encode(state, samples + i * pitch, sample_count - i, pitch, prebuf, 0, 1, SPU_ADPCM_FILTER_COUNT, SHIFT_RANGE_4BPS);
+		int filter_count = i ? SPU_ADPCM_FILTER_COUNT : first_filter_count;
+		buffer[0] = encode(state, samples + i * pitch, sample_count - i, pitch, prebuf, 0, 1, filter_count, SHIFT_RANGE_4BPS);
 		buffer[1] = 0;
 
 		for (int j = 0; j < 28; j+=2) {
@@ -314,6 +580,18 @@ int psx_audio_spu_encode(psx_audio_encoder_channel_state_t *state, int16_t* samp
 	return buffer - output;
 }
 
+int psx_audio_spu_encode(psx_audio_encoder_channel_state_t *state, int16_t* samples, int sample_count, int pitch, uint8_t *output) {
+	return encode_spu(state, samples, sample_count, pitch, output, SPU_ADPCM_FILTER_COUNT);
+}
+
+// Same as psx_audio_spu_encode(), but the first block is encoded with filter
+// 0, which doesn't use the previous samples, so it decodes the same no matter
+// what was played before it. This allows splitting up a sound and encoding
+// the pieces separately (in parallel), starting each with a fresh state.
+int psx_audio_spu_encode_sync(psx_audio_encoder_channel_state_t *state, int16_t* samples, int sample_count, int pitch, uint8_t *output) {
+	return encode_spu(state, samples, sample_count, pitch, output, 1);
+}
+
 int psx_audio_spu_encode_simple(int16_t* samples, int sample_count, uint8_t *output, int loop_start) {
 	psx_audio_encoder_channel_state_t state;
 	memset(&state, 0, sizeof(psx_audio_encoder_channel_state_t));
@@ -27,6 +27,10 @@ freely, subject to the following restrictions:
 #include <stdbool.h>
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // audio.c
 
 #define PSX_AUDIO_XA_FREQ_SINGLE 18900
@@ -46,10 +50,17 @@ typedef struct {
 	int channel_number; // 00-1F
 } psx_audio_xa_settings_t;
 
+typedef enum {
+	PSX_AUDIO_ADPCM_EXHAUSTIVE, // try every filter with shift factors around its ideal one (default)
+	PSX_AUDIO_ADPCM_FAST // only try the ideal shift factor of the filters predicted to work best
+} psx_audio_adpcm_quality_t;
+
 typedef struct {
 	int qerr; // quanitisation error
 	uint64_t mse; // mean square error
 	int prev1, prev2;
+	int prev_filter; // filter used by the previous block
+	psx_audio_adpcm_quality_t quality;
 } psx_audio_encoder_channel_state_t;
 
 typedef struct {
@@ -71,6 +82,7 @@ uint32_t psx_audio_xa_get_sector_interleave(psx_audio_xa_settings_t settings);
 int psx_audio_xa_encode(psx_audio_xa_settings_t settings, psx_audio_encoder_state_t *state, int16_t* samples, int sample_count, uint8_t *output);
 int psx_audio_xa_encode_simple(psx_audio_xa_settings_t settings, int16_t* samples, int sample_count, uint8_t *output);
 int psx_audio_spu_encode(psx_audio_encoder_channel_state_t *state, int16_t* samples, int sample_count, int pitch, uint8_t *output);
+int psx_audio_spu_encode_sync(psx_audio_encoder_channel_state_t *state, int16_t* samples, int sample_count, int pitch, uint8_t *output);
 int psx_audio_spu_encode_simple(int16_t* samples, int sample_count, uint8_t *output, int loop_start);
 void psx_audio_xa_encode_finalize(psx_audio_xa_settings_t settings, uint8_t *output, int output_length);
 void psx_audio_spu_set_flag_at_sample(uint8_t* spu_data, int sample_pos, int flag);
@@ -87,4 +99,8 @@ typedef enum {
 
 void psx_cdrom_calculate_checksums(uint8_t *sector, psx_cdrom_sector_type_t type);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* __LIBPSXAV_H__ */
\ No newline at end of file
@@ -0,0 +1,102 @@
+/*
+ * Signals used to test libpsxav's ADPCM encoder, covering the cases the filter
+ * and shift search has to get right: silence, broadband noise at full and low
+ * level, tones across the whole spectrum, clipping and sharp transients
+*/
+
+#include <math.h>
+#include "adpcm_corpus.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static int16_t clamp_sample(double x) {
+	if (x > 32767.0) { return 32767; }
+	if (x < -32768.0) { return -32768; }
+	return (int16_t)x;
+}
+
+static void generate_silence(int16_t *samples, int count) {
+	for (int i = 0; i < count; i++) {
+		samples[i] = 0;
+	}
+}
+
+// Full scale white noise
+static void generate_noise(int16_t *samples, int count) {
+	uint32_t seed = 0x12345678;
+	for (int i = 0; i < count; i++) {
+		seed = seed * 1103515245 + 12345;
+		samples[i] = (int16_t)(seed >> 16);
+	}
+}
+
+// White noise around -42dBFS, where the smallest shift factors get used
+static void generate_quiet_noise(int16_t *samples, int count) {
+	uint32_t seed = 0x87654321;
+	for (int i = 0; i < count; i++) {
+		seed = seed * 1103515245 + 12345;
+		samples[i] = (int16_t)(seed >> 16) >> 7;
+	}
+}
+
+// Logarithmic sine sweep from 20Hz to 20kHz
+static void generate_sweep(int16_t *samples, int count) {
+	double phase = 0.0;
+	for (int i = 0; i < count; i++) {
+		double freq = 20.0 * pow(1000.0, (double)i / count);
+		samples[i] = clamp_sample(sin(phase) * 24000.0);
+		phase += 2.0 * M_PI * freq / CORPUS_SAMPLE_RATE;
+	}
+}
+
+// 440Hz sine driven far enough past full scale to clip
+static void generate_clipped(int16_t *samples, int count) {
+	for (int i = 0; i < count; i++) {
+		samples[i] = clamp_sample(sin(2.0 * M_PI * 440.0 * i / CORPUS_SAMPLE_RATE) * 98304.0);
+	}
+}
+
+// 100Hz full scale square wave
+static void generate_square(int16_t *samples, int count) {
+	int period = CORPUS_SAMPLE_RATE / 100;
+	for (int i = 0; i < count; i++) {
+		samples[i] = ((i % period) < (period / 2)) ? 32767 : -32768;
+	}
+}
+
+// Alternating full scale clicks on silence, every 1000 samples
+static void generate_impulses(int16_t *samples, int count) {
+	for (int i = 0; i < count; i++) {
+		samples[i] = (i % 1000) ? 0 : ((i / 1000) & 1) ? -32768 : 32767;
+	}
+}
+
+// A major chord that decays away every half second, like a plucked instrument
+static void generate_chord(int16_t *samples, int count) {
+	static const double freqs[3] = {220.0, 277.18, 329.63};
+	for (int i = 0; i < count; i++) {
+		double t = (double)(i % (CORPUS_SAMPLE_RATE / 2)) / CORPUS_SAMPLE_RATE;
+		double x = 0.0;
+		for (int j = 0; j < 3; j++) {
+			x += sin(2.0 * M_PI * freqs[j] * i / CORPUS_SAMPLE_RATE);
+		}
+		samples[i] = clamp_sample(x * 10000.0 * exp(-8.0 * t));
+	}
+}
+
+// The fast search predicts filters from the block alone, which works worst on
+// the flat stretches and sharp edges of square waves
+const corpus_signal_t corpus_signals[] = {
+	{"silence", generate_silence, 0.0},
+	{"noise", generate_noise, 0.5},
+	{"quiet noise", generate_quiet_noise, 0.5},
+	{"sweep", generate_sweep, 1.0},
+	{"clipped", generate_clipped, 3.0},
+	{"square", generate_square, 7.0},
+	{"impulses", generate_impulses, 0.5},
+	{"chord", generate_chord, 3.0},
+};
+
+const int corpus_signal_count = sizeof(corpus_signals) / sizeof(corpus_signals[0]);
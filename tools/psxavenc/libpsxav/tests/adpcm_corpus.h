@@ -0,0 +1,22 @@
+/*
+ * Signals used to test libpsxav's ADPCM encoder
+*/
+
+#ifndef __ADPCM_CORPUS_H__
+#define __ADPCM_CORPUS_H__
+
+#include <stdint.h>
+
+#define CORPUS_SAMPLE_RATE 44100
+#define CORPUS_LENGTH (CORPUS_SAMPLE_RATE * 2)
+
+typedef struct {
+	const char *name;
+	void (*generate)(int16_t *samples, int count);
+	double fast_max_loss; // Most SNR PSX_AUDIO_ADPCM_FAST may lose on it, in dB
+} corpus_signal_t;
+
+extern const corpus_signal_t corpus_signals[];
+extern const int corpus_signal_count;
+
+#endif /* __ADPCM_CORPUS_H__ */
@@ -0,0 +1,114 @@
+/*
+ * adpcm_test
+ * Encodes the signals in adpcm_corpus.c with libpsxav's ADPCM encoder, both
+ * exhaustively and with PSX_AUDIO_ADPCM_FAST, and writes the result out so
+ * builds with and without LIBPSXAV_NO_SIMD can be compared. Fails if the fast
+ * search loses more quality on a signal than the corpus allows.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "libpsxav.h"
+#include "adpcm_corpus.h"
+
+static const int16_t filter_k1[5] = {0, 60, 115, 98, 122};
+static const int16_t filter_k2[5] = {0, 0, -52, -55, -60};
+
+// Decodes SPU-ADPCM the way the SPU does and returns the SNR against the
+// original samples
+static double spu_snr(const uint8_t *data, int length, const int16_t *samples, int sample_count) {
+	double signal = 0.0, noise = 0.0;
+	int prev1 = 0, prev2 = 0;
+
+	for (int i = 0; i < sample_count; i++) {
+		const uint8_t *block = &data[(i / 28) * 16];
+		if ((i / 28) * 16 >= length) { break; }
+
+		int shift = block[0] & 0x0F;
+		int filter = block[0] >> 4;
+		int nibble = (block[2 + (i % 28) / 2] >> (((i % 28) & 1) * 4)) & 0x0F;
+
+		int32_t sample = (int16_t)(nibble << 12) >> shift;
+		sample += (filter_k1[filter] * prev1 + filter_k2[filter] * prev2 + 32) >> 6;
+		if (sample > 32767) { sample = 32767; }
+		if (sample < -32768) { sample = -32768; }
+		prev2 = prev1;
+		prev1 = sample;
+
+		double error = sample - samples[i];
+		signal += (double)samples[i] * samples[i];
+		noise += error * error;
+	}
+
+	if (noise == 0.0) { return INFINITY; }
+	return 10.0 * log10(signal / noise);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		printf("usage: adpcm_test out.bin\n");
+		return 1;
+	}
+
+	FILE *out = fopen(argv[1], "wb");
+	if (out == NULL) {
+		printf("Failed to open %s\n", argv[1]);
+		return 1;
+	}
+
+	psx_audio_xa_settings_t settings = {PSX_AUDIO_XA_FORMAT_XA, true, PSX_AUDIO_XA_FREQ_DOUBLE, 4, 0, 0};
+	int16_t *samples = malloc(CORPUS_LENGTH * sizeof(int16_t));
+	int16_t *stereo = malloc(CORPUS_LENGTH * 2 * sizeof(int16_t));
+	uint8_t *buffer = malloc(psx_audio_xa_get_buffer_size(settings, CORPUS_LENGTH));
+	if (samples == NULL || stereo == NULL || buffer == NULL) {
+		printf("Failed to allocate buffers\n");
+		return 1;
+	}
+
+	int failed = 0;
+	for (int i = 0; i < corpus_signal_count; i++) {
+		corpus_signals[i].generate(samples, CORPUS_LENGTH);
+
+		// The right channel gets the signal reversed
+		for (int j = 0; j < CORPUS_LENGTH; j++) {
+			stereo[j * 2 + 0] = samples[j];
+			stereo[j * 2 + 1] = samples[CORPUS_LENGTH - 1 - j];
+		}
+
+		double snr[2];
+		for (int quality = PSX_AUDIO_ADPCM_EXHAUSTIVE; quality <= PSX_AUDIO_ADPCM_FAST; quality++) {
+			// SPU-ADPCM
+			psx_audio_encoder_channel_state_t state;
+			memset(&state, 0, sizeof(state));
+			state.quality = quality;
+			int length = psx_audio_spu_encode(&state, samples, CORPUS_LENGTH, 1, buffer);
+			fwrite(buffer, 1, length, out);
+			snr[quality] = spu_snr(buffer, length, samples, CORPUS_LENGTH);
+
+			// 4-bit stereo XA-ADPCM
+			psx_audio_encoder_state_t xa_state;
+			memset(&xa_state, 0, sizeof(xa_state));
+			xa_state.left.quality = quality;
+			xa_state.right.quality = quality;
+			length = psx_audio_xa_encode(settings, &xa_state, stereo, CORPUS_LENGTH, buffer);
+			psx_audio_xa_encode_finalize(settings, buffer, length);
+			fwrite(buffer, 1, length, out);
+		}
+
+		double loss = (snr[0] == snr[1]) ? 0.0 : snr[0] - snr[1];
+		printf("%-12s exhaustive %6.2f dB, fast %6.2f dB (%.2f dB lost)\n", corpus_signals[i].name, snr[0], snr[1], loss);
+		if (loss > corpus_signals[i].fast_max_loss) {
+			printf("%s: fast search lost more than %.1f dB\n", corpus_signals[i].name, corpus_signals[i].fast_max_loss);
+			failed = 1;
+		}
+	}
+
+	free(samples);
+	free(stereo);
+	free(buffer);
+	fclose(out);
+	return failed;
+}
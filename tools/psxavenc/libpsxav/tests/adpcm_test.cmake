@@ -0,0 +1,25 @@
+# Runs the SIMD and scalar (LIBPSXAV_NO_SIMD) builds of adpcm_test, which each
+# check the fast search against the exhaustive one, and checks that they encode
+# every signal in both modes bit-for-bit the same.
+#
+# cmake -DSIMD=adpcm_test -DSCALAR=adpcm_test_scalar -DOUT_DIR=dir -P adpcm_test.cmake
+
+foreach(_build IN ITEMS SIMD SCALAR)
+    execute_process(
+        COMMAND ${${_build}} ${OUT_DIR}/adpcm_test_${_build}.bin
+        RESULT_VARIABLE _result
+    )
+    if(NOT _result EQUAL 0)
+        message(FATAL_ERROR "${_build} build of adpcm_test failed (${_result})")
+    endif()
+endforeach()
+
+execute_process(
+    COMMAND ${CMAKE_COMMAND} -E compare_files
+        ${OUT_DIR}/adpcm_test_SIMD.bin
+        ${OUT_DIR}/adpcm_test_SCALAR.bin
+    RESULT_VARIABLE _result
+)
+if(NOT _result EQUAL 0)
+    message(FATAL_ERROR "SIMD and scalar ADPCM encoders disagree")
+endif()
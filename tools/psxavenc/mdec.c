@@ -22,11 +22,14 @@ freely, subject to the following restrictions:
 3. This notice may not be removed or altered from any source distribution.
 */
 
+#include <pthread.h>
+#include <stdatomic.h>
 #include "common.h"
 
 // high 8 bits = bit count
 // low 24 bits = value
 uint32_t huffman_encoding_map[0x10000];
+float dct_post_scale[8*8];
 bool dct_done_init = false;
 
 #define MAKE_HUFFMAN_PAIR(zeroes, value) (((zeroes)<<10)|((+(value))&0x3FF)),(((zeroes)<<10)|((-(value))&0x3FF))
@@ -208,6 +211,19 @@ static void init_dct_data(void)
 		huffman_encoding_map[huffman_lookup[i].u_hword_neg] = (bits<<24)|(base_value<<1)|1;
 	}
 
+	// The AAN DCT leaves each output scaled by 4*cos(i*pi/16) (2*sqrt(2) for
+	// the DC) compared to dct_scale_table, whose first column holds
+	// cos(i*pi/16) (1/sqrt(2) for the DC) in 1.15 fixed point.
+	float scale[8];
+	scale[0] = (float)dct_scale_table[0] / (float)(1 << 16);
+	for (int i = 1; i < 8; i++) {
+		scale[i] = (float)(1 << 13) / (float)dct_scale_table[8*i];
+	}
+	for (int i = 0; i < 8; i++) {
+	for (int j = 0; j < 8; j++) {
+		dct_post_scale[8*i+j] = scale[i] * scale[j];
+	}
+	}
 }
 
 static bool flush_bits(vid_encoder_state_t *state)
@@ -301,35 +317,185 @@ static bool encode_ac_value(vid_encoder_state_t *state, uint16_t value)
 #endif
 }
 
-static void transform_dct_block(vid_encoder_state_t *state, float *block)
+// The DCT is done on several blocks at once, one per SIMD lane.
+#if defined(__AVX__)
+#include <immintrin.h>
+#define DCT_LANES 8
+typedef __m256 dct_vec_t;
+#define dct_add(a, b) _mm256_add_ps(a, b)
+#define dct_sub(a, b) _mm256_sub_ps(a, b)
+#define dct_mul(a, k) _mm256_mul_ps(a, _mm256_set1_ps(k))
+
+// Element i of every block goes into v[i], 4 elements at a time through
+// a 4x4 transpose for each half of the lanes.
+static inline void dct_load_blocks(dct_vec_t *v, float **blocks)
 {
-	// Apply DCT to block
-	float midblock[8*8];
+	for (int i = 0; i < 8*8; i += 4) {
+		__m128 a[4], b[4];
+		for (int l = 0; l < 4; l++) {
+			a[l] = _mm_loadu_ps(blocks[l] + i);
+			b[l] = _mm_loadu_ps(blocks[l+4] + i);
+		}
+		_MM_TRANSPOSE4_PS(a[0], a[1], a[2], a[3]);
+		_MM_TRANSPOSE4_PS(b[0], b[1], b[2], b[3]);
+		for (int l = 0; l < 4; l++) {
+			v[i+l] = _mm256_insertf128_ps(_mm256_castps128_ps256(a[l]), b[l], 1);
+		}
+	}
+}
 
-	for (int i = 0; i < 8; i++) {
-	for (int j = 0; j < 8; j++) {
-		float v = 0.0f;
-		for(int k = 0; k < 8; k++) {
-			v += block[8*j+k] * (float)dct_scale_table[8*i+k] / (float)(1 << 16);
+static inline void dct_store_blocks(float **blocks, dct_vec_t *v)
+{
+	for (int i = 0; i < 8*8; i += 4) {
+		__m128 a[4], b[4];
+		for (int l = 0; l < 4; l++) {
+			a[l] = _mm256_castps256_ps128(v[i+l]);
+			b[l] = _mm256_extractf128_ps(v[i+l], 1);
+		}
+		_MM_TRANSPOSE4_PS(a[0], a[1], a[2], a[3]);
+		_MM_TRANSPOSE4_PS(b[0], b[1], b[2], b[3]);
+		for (int l = 0; l < 4; l++) {
+			_mm_storeu_ps(blocks[l] + i, a[l]);
+			_mm_storeu_ps(blocks[l+4] + i, b[l]);
 		}
-		midblock[8*i+j] = v;
 	}
+}
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define DCT_LANES 4
+typedef __m128 dct_vec_t;
+#define dct_add(a, b) _mm_add_ps(a, b)
+#define dct_sub(a, b) _mm_sub_ps(a, b)
+#define dct_mul(a, k) _mm_mul_ps(a, _mm_set1_ps(k))
+
+// Element i of every block goes into v[i], 4 elements at a time through
+// a 4x4 transpose.
+static inline void dct_load_blocks(dct_vec_t *v, float **blocks)
+{
+	for (int i = 0; i < 8*8; i += 4) {
+		__m128 a0 = _mm_loadu_ps(blocks[0] + i);
+		__m128 a1 = _mm_loadu_ps(blocks[1] + i);
+		__m128 a2 = _mm_loadu_ps(blocks[2] + i);
+		__m128 a3 = _mm_loadu_ps(blocks[3] + i);
+		_MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+		v[i+0] = a0;
+		v[i+1] = a1;
+		v[i+2] = a2;
+		v[i+3] = a3;
 	}
-	for (int i = 0; i < 8; i++) {
-	for (int j = 0; j < 8; j++) {
-		float v = 0.0f;
-		for(int k = 0; k < 8; k++) {
-			v += midblock[8*j+k] * (float)dct_scale_table[8*i+k] / (float)(1 << 16);
-		}
-		block[8*i+j] = v;
+}
+
+static inline void dct_store_blocks(float **blocks, dct_vec_t *v)
+{
+	for (int i = 0; i < 8*8; i += 4) {
+		__m128 a0 = v[i+0];
+		__m128 a1 = v[i+1];
+		__m128 a2 = v[i+2];
+		__m128 a3 = v[i+3];
+		_MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+		_mm_storeu_ps(blocks[0] + i, a0);
+		_mm_storeu_ps(blocks[1] + i, a1);
+		_mm_storeu_ps(blocks[2] + i, a2);
+		_mm_storeu_ps(blocks[3] + i, a3);
 	}
+}
+#else
+#define DCT_LANES 1
+typedef float dct_vec_t;
+#define dct_add(a, b) ((a) + (b))
+#define dct_sub(a, b) ((a) - (b))
+#define dct_mul(a, k) ((a) * (k))
+
+static inline void dct_load_blocks(dct_vec_t *v, float **blocks)
+{
+	memcpy(v, blocks[0], sizeof(float)*8*8);
+}
+
+static inline void dct_store_blocks(float **blocks, dct_vec_t *v)
+{
+	memcpy(blocks[0], v, sizeof(float)*8*8);
+}
+#endif
+
+// Arai-Agui-Nakajima 8-point DCT, leaving out the final scaling of each
+// output (that's done in one go by dct_post_scale after both passes).
+static inline void aan_dct_8(dct_vec_t *d, int stride)
+{
+	dct_vec_t tmp0 = dct_add(d[0*stride], d[7*stride]);
+	dct_vec_t tmp7 = dct_sub(d[0*stride], d[7*stride]);
+	dct_vec_t tmp1 = dct_add(d[1*stride], d[6*stride]);
+	dct_vec_t tmp6 = dct_sub(d[1*stride], d[6*stride]);
+	dct_vec_t tmp2 = dct_add(d[2*stride], d[5*stride]);
+	dct_vec_t tmp5 = dct_sub(d[2*stride], d[5*stride]);
+	dct_vec_t tmp3 = dct_add(d[3*stride], d[4*stride]);
+	dct_vec_t tmp4 = dct_sub(d[3*stride], d[4*stride]);
+
+	// Even part
+	dct_vec_t tmp10 = dct_add(tmp0, tmp3);
+	dct_vec_t tmp13 = dct_sub(tmp0, tmp3);
+	dct_vec_t tmp11 = dct_add(tmp1, tmp2);
+	dct_vec_t tmp12 = dct_sub(tmp1, tmp2);
+
+	d[0*stride] = dct_add(tmp10, tmp11);
+	d[4*stride] = dct_sub(tmp10, tmp11);
+
+	dct_vec_t z1 = dct_mul(dct_add(tmp12, tmp13), 0.707106781f);
+	d[2*stride] = dct_add(tmp13, z1);
+	d[6*stride] = dct_sub(tmp13, z1);
+
+	// Odd part
+	tmp10 = dct_add(tmp4, tmp5);
+	tmp11 = dct_add(tmp5, tmp6);
+	tmp12 = dct_add(tmp6, tmp7);
+
+	dct_vec_t z5 = dct_mul(dct_sub(tmp10, tmp12), 0.382683433f);
+	dct_vec_t z2 = dct_add(dct_mul(tmp10, 0.541196100f), z5);
+	dct_vec_t z4 = dct_add(dct_mul(tmp12, 1.306562965f), z5);
+	dct_vec_t z3 = dct_mul(tmp11, 0.707106781f);
+
+	dct_vec_t z11 = dct_add(tmp7, z3);
+	dct_vec_t z13 = dct_sub(tmp7, z3);
+
+	d[5*stride] = dct_add(z13, z2);
+	d[3*stride] = dct_sub(z13, z2);
+	d[1*stride] = dct_add(z11, z4);
+	d[7*stride] = dct_sub(z11, z4);
+}
+
+// Apply DCT to blocks, giving the same coefficients as a multiplication by
+// dct_scale_table (divided by 1<<16) on each side.
+static void transform_dct_blocks(float **blocks, int count)
+{
+	// Unused lanes of the last group work on a dummy block.
+	float dummy[8*8] = { 0.0f };
+	dct_vec_t v[8*8];
+
+	for (int b = 0; b < count; b += DCT_LANES) {
+		float *group[DCT_LANES];
+		for (int l = 0; l < DCT_LANES; l++) {
+			group[l] = (b+l < count) ? blocks[b+l] : dummy;
+		}
+
+		dct_load_blocks(v, group);
+
+		for (int i = 0; i < 8; i++) {
+			aan_dct_8(&v[8*i], 1);
+		}
+		for (int i = 0; i < 8; i++) {
+			aan_dct_8(&v[i], 8);
+		}
+
+		for (int i = 0; i < 8*8; i++) {
+			v[i] = dct_mul(v[i], dct_post_scale[i]);
+		}
+
+		dct_store_blocks(group, v);
 	}
 }
 
-static bool encode_dct_block(vid_encoder_state_t *state, float *block)
+static void quantize_dct_block(int quant_scale, const float *block, int16_t *coeffs)
 {
-	int16_t coeffs[64];
-	float scale = 8.0f / (float)state->quant_scale;
+	float scale = 8.0f / (float)quant_scale;
 
 	for (int i = 0; i < 64; i++) {
 		// The DC coefficient is not affected by the quantization scale.
@@ -341,6 +507,12 @@ static bool encode_dct_block(vid_encoder_state_t *state, float *block)
 		if (v > +0x1FF) { v = +0x1FF; }
 		coeffs[i] = v;
 	}
+}
+
+static bool encode_dct_block(vid_encoder_state_t *state, float *block)
+{
+	int16_t coeffs[64];
+	quantize_dct_block(state->quant_scale, block, coeffs);
 
 	if (!encode_bits(state, 10, coeffs[0]&0x3FF)) {
 		return false;
@@ -404,9 +576,345 @@ static int reduce_dct_block(vid_encoder_state_t *state, int32_t *block, int32_t
 }
 #endif
 
+#define MAX_THREADS 64
+
+typedef void (*parallel_func_t)(void *arg, int index);
+
+typedef struct {
+	struct vid_worker_pool_t *pool;
+	int index;
+} vid_worker_t;
+
+// Worker threads kept around for the whole encode, as a frame runs several
+// short parallel passes (one per quantization scale attempt).
+typedef struct vid_worker_pool_t {
+	pthread_t threads[MAX_THREADS];
+	vid_worker_t workers[MAX_THREADS];
+	int thread_count; // Including the calling thread
+	pthread_mutex_t mutex;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	parallel_func_t func;
+	void *arg;
+	int count;
+	int generation; // Bumped for every job
+	int pending; // Workers still busy with the current job
+	bool quit;
+} vid_worker_pool_t;
+
+static void run_share(vid_worker_pool_t *pool, int index)
+{
+	for (int i = index; i < pool->count; i += pool->thread_count) {
+		pool->func(pool->arg, i);
+	}
+}
+
+static void *pool_worker(void *arg)
+{
+	vid_worker_t *worker = (vid_worker_t *)arg;
+	vid_worker_pool_t *pool = worker->pool;
+	int generation = 0;
+
+	pthread_mutex_lock(&(pool->mutex));
+	for (;;) {
+		while (!pool->quit && pool->generation == generation) {
+			pthread_cond_wait(&(pool->start), &(pool->mutex));
+		}
+		if (pool->quit) { break; }
+		generation = pool->generation;
+		pthread_mutex_unlock(&(pool->mutex));
+
+		run_share(pool, worker->index);
+
+		pthread_mutex_lock(&(pool->mutex));
+		if (--pool->pending == 0) {
+			pthread_cond_signal(&(pool->done));
+		}
+	}
+	pthread_mutex_unlock(&(pool->mutex));
+	return NULL;
+}
+
+static vid_worker_pool_t *create_worker_pool(int thread_count)
+{
+	if (thread_count > MAX_THREADS) { thread_count = MAX_THREADS; }
+	if (thread_count < 1) { thread_count = 1; }
+
+	vid_worker_pool_t *pool = calloc(1, sizeof(vid_worker_pool_t));
+	pthread_mutex_init(&(pool->mutex), NULL);
+	pthread_cond_init(&(pool->start), NULL);
+	pthread_cond_init(&(pool->done), NULL);
+
+	// If a thread can't be spawned, make do with the ones that could be.
+	pool->thread_count = 1;
+	for (int t = 1; t < thread_count; t++) {
+		pool->workers[t].pool = pool;
+		pool->workers[t].index = t;
+		if (pthread_create(&(pool->threads[t]), NULL, pool_worker, &(pool->workers[t])) != 0) { break; }
+		pool->thread_count++;
+	}
+	return pool;
+}
+
+static void destroy_worker_pool(vid_worker_pool_t *pool)
+{
+	pthread_mutex_lock(&(pool->mutex));
+	pool->quit = true;
+	pthread_cond_broadcast(&(pool->start));
+	pthread_mutex_unlock(&(pool->mutex));
+
+	for (int t = 1; t < pool->thread_count; t++) {
+		pthread_join(pool->threads[t], NULL);
+	}
+	pthread_cond_destroy(&(pool->done));
+	pthread_cond_destroy(&(pool->start));
+	pthread_mutex_destroy(&(pool->mutex));
+	free(pool);
+}
+
+// Calls func for every index in 0..count-1, spread across the worker threads
+// (the calling thread takes the first share).
+static void run_parallel(settings_t *settings, int count, parallel_func_t func, void *arg)
+{
+	vid_worker_pool_t *pool = settings->state_vid.pool;
+
+	pthread_mutex_lock(&(pool->mutex));
+	pool->func = func;
+	pool->arg = arg;
+	pool->count = count;
+	pool->pending = pool->thread_count - 1;
+	pool->generation++;
+	pthread_cond_broadcast(&(pool->start));
+	pthread_mutex_unlock(&(pool->mutex));
+
+	run_share(pool, 0);
+
+	pthread_mutex_lock(&(pool->mutex));
+	while (pool->pending) {
+		pthread_cond_wait(&(pool->done), &(pool->mutex));
+	}
+	pthread_mutex_unlock(&(pool->mutex));
+}
+
+typedef struct {
+	settings_t *settings;
+	uint8_t *y_plane;
+	uint8_t *c_plane;
+	int dct_block_count_x;
+	int dct_block_count_y;
+	atomic_int bytes_used;
+	struct {
+		bool ok;
+		int bits;
+		int uncomp_hwords;
+	} slice_results[];
+} frame_job_t;
+
+static void get_macroblock(frame_job_t *job, int fx, int fy, float *blocks[6])
+{
+	// Order: Cr Cb [Y1|Y2\nY3|Y4]
+	int block_offs = 64 * (fy*job->dct_block_count_x + fx);
+	for (int i = 0; i < 6; i++) {
+		blocks[i] = job->settings->state_vid.dct_block_lists[i] + block_offs;
+	}
+}
+
+static void transform_slice(void *arg, int fx)
+{
+	frame_job_t *job = (frame_job_t *)arg;
+	int pitch = job->settings->video_width;
+
+	// Transform a few macroblocks at a time to keep all SIMD lanes busy.
+	float *pending[6*4];
+	int pending_count = 0;
+
+	for(int fy = 0; fy < job->dct_block_count_y; fy++) {
+		float **blocks = &pending[pending_count];
+		get_macroblock(job, fx, fy, blocks);
+		pending_count += 6;
+
+		for(int y = 0; y < 8; y++) {
+		for(int x = 0; x < 8; x++) {
+			int k = y*8 + x;
+			int cx = fx*8 + x;
+			int cy = fy*8 + y;
+			int lx = fx*16 + x;
+			int ly = fy*16 + y;
+
+			blocks[0][k] = (float)job->c_plane[pitch*cy + 2*cx + 0] - 128.0f;
+			blocks[1][k] = (float)job->c_plane[pitch*cy + 2*cx + 1] - 128.0f;
+			blocks[2][k] = (float)job->y_plane[pitch*(ly+0) + (lx+0)] - 128.0f;
+			blocks[3][k] = (float)job->y_plane[pitch*(ly+0) + (lx+8)] - 128.0f;
+			blocks[4][k] = (float)job->y_plane[pitch*(ly+8) + (lx+0)] - 128.0f;
+			blocks[5][k] = (float)job->y_plane[pitch*(ly+8) + (lx+8)] - 128.0f;
+		}
+		}
+
+		if (pending_count == 6*4 || fy == job->dct_block_count_y-1) {
+			transform_dct_blocks(pending, pending_count);
+			pending_count = 0;
+		}
+	}
+}
+
+// Each column of macroblocks is Huffman coded into its own bitstream, which
+// can be done independently of the other columns. The slices are then
+// stitched back together in order, giving the same output as coding the
+// whole frame in one go.
+static void encode_slice(void *arg, int fx)
+{
+	frame_job_t *job = (frame_job_t *)arg;
+	vid_encoder_state_t *slice = &(job->settings->state_vid.slices[fx]);
+
+	slice->frame_max_size = job->settings->state_vid.frame_max_size;
+	slice->quant_scale = job->settings->state_vid.quant_scale;
+	slice->bits_value = 0;
+	slice->bits_left = 16;
+	slice->uncomp_hwords_used = 0;
+	slice->bytes_used = 0;
+
+	bool ok = true;
+	for(int fy = 0; ok && (fy < job->dct_block_count_y); fy++) {
+		float *blocks[6];
+		get_macroblock(job, fx, fy, blocks);
+
+		int last_bytes_used = slice->bytes_used;
+		for(int i = 0; ok && (i < 6); i++) {
+			ok = encode_dct_block(slice, blocks[i]);
+		}
+
+		// Give up early once all slices together no longer fit in the frame.
+		int bytes_used = atomic_fetch_add(&(job->bytes_used), slice->bytes_used - last_bytes_used);
+		bytes_used += slice->bytes_used - last_bytes_used;
+		if (bytes_used >= slice->frame_max_size) {
+			ok = false;
+		}
+	}
+	job->slice_results[fx].ok = ok;
+}
+
+// Works out how many bits and uncompressed halfwords a column of macroblocks
+// takes up at the current quantization scale, without encoding it.
+static void measure_slice(void *arg, int fx)
+{
+	frame_job_t *job = (frame_job_t *)arg;
+	int quant_scale = job->settings->state_vid.quant_scale;
+	int bits = 0;
+	int uncomp_hwords = 0;
+
+	for(int fy = 0; fy < job->dct_block_count_y; fy++) {
+		float *blocks[6];
+		get_macroblock(job, fx, fy, blocks);
+
+		for(int i = 0; i < 6; i++) {
+			int16_t coeffs[64];
+			quantize_dct_block(quant_scale, blocks[i], coeffs);
+
+			// DC coefficient and end of block
+			bits += 10 + 2;
+			uncomp_hwords += 2;
+
+			for (int j = 1, zeroes = 0; j < 64; j++) {
+				int rj = dct_zagzig_table[j];
+				if (coeffs[rj] == 0) {
+					zeroes++;
+				} else {
+					bits += huffman_encoding_map[(zeroes<<10)|(coeffs[rj]&0x3FF)]>>24;
+					zeroes = 0;
+					uncomp_hwords++;
+				}
+			}
+		}
+	}
+
+	job->slice_results[fx].bits = bits;
+	job->slice_results[fx].uncomp_hwords = uncomp_hwords;
+}
+
+// Size of the decompressed MDEC data of a frame in 32-bit words, as stored
+// in its header.
+static int get_mdec_words(int uncomp_hwords)
+{
+	// MDEC DMA is usually configured to transfer data in 32-word chunks.
+	return (((uncomp_hwords+0x3F)&~0x3F)+1)>>1;
+}
+
+static bool frame_fits(frame_job_t *job)
+{
+	settings_t *settings = job->settings;
+	run_parallel(settings, job->dct_block_count_x, measure_slice, job);
+
+	// Header and end of frame code
+	int bits = 10 + 2;
+	int uncomp_hwords = 2;
+	for (int fx = 0; fx < job->dct_block_count_x; fx++) {
+		bits += job->slice_results[fx].bits;
+		uncomp_hwords += job->slice_results[fx].uncomp_hwords;
+	}
+
+	if (8 + (bits+15)/16*2 > settings->state_vid.frame_max_size) {
+		return false;
+	}
+	if (settings->max_mdec_words && get_mdec_words(uncomp_hwords) > settings->max_mdec_words) {
+		return false;
+	}
+	return true;
+}
+
+// Finds the lowest quantization scale the frame fits at by measuring it at
+// a few scales, starting from the one used for the previous frame (which
+// is likely to be close) and moving away from it in growing steps until
+// the answer is bracketed. Returns 64 if it doesn't fit at all.
+static int plan_quant_scale(frame_job_t *job)
+{
+	int fits_above = 64;
+	int fails_below = 0;
+	int step = 1;
+
+	int quant_scale = job->settings->state_vid.quant_scale;
+	if (quant_scale < 1) { quant_scale = 1; }
+	if (quant_scale > 63) { quant_scale = 63; }
+
+	while (fits_above - fails_below > 1) {
+		job->settings->state_vid.quant_scale = quant_scale;
+		if (frame_fits(job)) {
+			fits_above = quant_scale;
+			quant_scale -= step;
+		} else {
+			fails_below = quant_scale;
+			quant_scale += step;
+		}
+		step *= 2;
+
+		if (quant_scale <= fails_below || quant_scale >= fits_above) {
+			quant_scale = (fails_below + fits_above) / 2;
+		}
+	}
+
+	return fits_above;
+}
+
+static bool append_slice(vid_encoder_state_t *state, vid_encoder_state_t *slice)
+{
+	// Flushed halfwords are stored little endian.
+	for (int i = 0; i < slice->bytes_used; i += 2) {
+		uint32_t hword = slice->frame_output[i] | (slice->frame_output[i+1] << 8);
+		if (!encode_bits(state, 16, hword)) {
+			return false;
+		}
+	}
+
+	int bits = 16 - slice->bits_left;
+	if (bits > 0 && !encode_bits(state, bits, slice->bits_value >> slice->bits_left)) {
+		return false;
+	}
+
+	state->uncomp_hwords_used += slice->uncomp_hwords_used;
+	return true;
+}
+
 void encode_frame_bs(uint8_t *video_frame, settings_t *settings)
 {
-	int pitch = settings->video_width;
 	/*int real_index = (settings->state_vid.frame_index-1);
 	if (real_index > video_frame_count-1) {
 		real_index = video_frame_count-1;
@@ -429,56 +937,43 @@ void encode_frame_bs(uint8_t *video_frame, settings_t *settings)
 			settings->state_vid.dct_block_lists[i] = malloc(dct_block_size);
 		}
 	}
+	if (settings->state_vid.slices == NULL) {
+		settings->state_vid.slices = calloc(dct_block_count_x, sizeof(vid_encoder_state_t));
+	}
+	if (settings->state_vid.pool == NULL) {
+		settings->state_vid.pool = create_worker_pool(settings->threads);
+	}
+	for (int fx = 0; fx < dct_block_count_x; fx++) {
+		// A slice can't be larger than the frame, as encode_slice() fails
+		// as soon as it would be.
+		vid_encoder_state_t *slice = &(settings->state_vid.slices[fx]);
+		slice->frame_output = realloc(slice->frame_output, settings->state_vid.frame_max_size);
+	}
 
 	// TODO: non-16x16-aligned videos
 	assert((settings->video_width % 16) == 0);
 	assert((settings->video_height % 16) == 0);
 
-	// Rearrange the Y/C planes returned by libswscale into macroblocks.
-	for(int fx = 0; fx < dct_block_count_x; fx++) {
-	for(int fy = 0; fy < dct_block_count_y; fy++) {
-		// Order: Cr Cb [Y1|Y2\nY3|Y4]
-		int block_offs = 64 * (fy*dct_block_count_x + fx);
-		float *blocks[6] = {
-			settings->state_vid.dct_block_lists[0] + block_offs,
-			settings->state_vid.dct_block_lists[1] + block_offs,
-			settings->state_vid.dct_block_lists[2] + block_offs,
-			settings->state_vid.dct_block_lists[3] + block_offs,
-			settings->state_vid.dct_block_lists[4] + block_offs,
-			settings->state_vid.dct_block_lists[5] + block_offs,
-		};
-
-		for(int y = 0; y < 8; y++) {
-		for(int x = 0; x < 8; x++) {
-			int k = y*8 + x;
-			int cx = fx*8 + x;
-			int cy = fy*8 + y;
-			int lx = fx*16 + x;
-			int ly = fy*16 + y;
-
-			blocks[0][k] = (float)c_plane[pitch*cy + 2*cx + 0] - 128.0f;
-			blocks[1][k] = (float)c_plane[pitch*cy + 2*cx + 1] - 128.0f;
-			blocks[2][k] = (float)y_plane[pitch*(ly+0) + (lx+0)] - 128.0f;
-			blocks[3][k] = (float)y_plane[pitch*(ly+0) + (lx+8)] - 128.0f;
-			blocks[4][k] = (float)y_plane[pitch*(ly+8) + (lx+0)] - 128.0f;
-			blocks[5][k] = (float)y_plane[pitch*(ly+8) + (lx+8)] - 128.0f;
-		}
-		}
+	frame_job_t *job = malloc(sizeof(frame_job_t) + dct_block_count_x*sizeof(job->slice_results[0]));
+	job->settings = settings;
+	job->y_plane = y_plane;
+	job->c_plane = c_plane;
+	job->dct_block_count_x = dct_block_count_x;
+	job->dct_block_count_y = dct_block_count_y;
 
-		for(int i = 0; i < 6; i++) {
-			transform_dct_block(&(settings->state_vid), blocks[i]);
-		}
-	}
-	}
+	// Rearrange the Y/C planes returned by libswscale into macroblocks.
+	run_parallel(settings, dct_block_count_x, transform_slice, job);
 
 	// Attempt encoding the frame at the maximum quality. If the result is too
-	// large, increase the quantization scale and try again.
+	// large, increase the quantization scale and try again. In two-pass mode
+	// the frame is measured first to skip straight to the right scale.
 	// TODO: if a frame encoded at scale N is too large but the same frame
 	// encoded at scale N-1 leaves a significant amount of free space, attempt
 	// compressing at scale N but optimizing coefficients away until it fits
 	// (like the old algorithm did)
+	int first_quant_scale = settings->two_pass ? plan_quant_scale(job) : 1;
 	for (
-		settings->state_vid.quant_scale = 1;
+		settings->state_vid.quant_scale = first_quant_scale;
 		settings->state_vid.quant_scale < 64;
 		settings->state_vid.quant_scale++
 	) {
@@ -489,24 +984,12 @@ void encode_frame_bs(uint8_t *video_frame, settings_t *settings)
 		settings->state_vid.uncomp_hwords_used = 0;
 		settings->state_vid.bytes_used = 8;
 
+		atomic_store(&(job->bytes_used), settings->state_vid.bytes_used);
+		run_parallel(settings, dct_block_count_x, encode_slice, job);
+
 		bool ok = true;
 		for(int fx = 0; ok && (fx < dct_block_count_x); fx++) {
-		for(int fy = 0; ok && (fy < dct_block_count_y); fy++) {
-			// Order: Cr Cb [Y1|Y2\nY3|Y4]
-			int block_offs = 64 * (fy*dct_block_count_x + fx);
-			float *blocks[6] = {
-				settings->state_vid.dct_block_lists[0] + block_offs,
-				settings->state_vid.dct_block_lists[1] + block_offs,
-				settings->state_vid.dct_block_lists[2] + block_offs,
-				settings->state_vid.dct_block_lists[3] + block_offs,
-				settings->state_vid.dct_block_lists[4] + block_offs,
-				settings->state_vid.dct_block_lists[5] + block_offs,
-			};
-
-			for(int i = 0; ok && (i < 6); i++) {
-				ok = encode_dct_block(&(settings->state_vid), blocks[i]);
-			}
-		}
+			ok = job->slice_results[fx].ok && append_slice(&(settings->state_vid), &(settings->state_vid.slices[fx]));
 		}
 
 		if (!ok) { continue; }
@@ -515,20 +998,22 @@ void encode_frame_bs(uint8_t *video_frame, settings_t *settings)
 		if (!flush_bits(&(settings->state_vid))) { continue; }
 
 		settings->state_vid.uncomp_hwords_used += 2;
+		if (settings->max_mdec_words && get_mdec_words(settings->state_vid.uncomp_hwords_used) > settings->max_mdec_words) {
+			continue;
+		}
 		settings->state_vid.quant_scale_sum += settings->state_vid.quant_scale;
 		break;
 	}
 	assert(settings->state_vid.quant_scale < 64);
-
-	// MDEC DMA is usually configured to transfer data in 32-word chunks.
-	settings->state_vid.uncomp_hwords_used = (settings->state_vid.uncomp_hwords_used+0x3F)&~0x3F;
+	free(job);
 
 	// This is not the number of 32-byte blocks required for uncompressed data
 	// as jPSXdec docs say, but rather the number of 32-*bit* words required.
 	// The first 4 bytes of the frame header are in fact the MDEC command to
 	// start decoding, which contains the data length in words in the lower 16
 	// bits.
-	settings->state_vid.blocks_used = (settings->state_vid.uncomp_hwords_used+1)>>1;
+	settings->state_vid.uncomp_hwords_used = (settings->state_vid.uncomp_hwords_used+0x3F)&~0x3F;
+	settings->state_vid.blocks_used = get_mdec_words(settings->state_vid.uncomp_hwords_used);
 
 	// We need a multiple of 4
 	settings->state_vid.bytes_used = (settings->state_vid.bytes_used+0x3)&~0x3;
@@ -550,6 +1035,28 @@ void encode_frame_bs(uint8_t *video_frame, settings_t *settings)
 	retire_av_data(settings, 0, 1);
 }
 
+// Stops the worker threads and frees the buffers encode_frame_bs() keeps
+// between frames, once the whole video has been encoded.
+void free_frame_bs(settings_t *settings)
+{
+	if (settings->state_vid.pool != NULL) {
+		destroy_worker_pool(settings->state_vid.pool);
+		settings->state_vid.pool = NULL;
+	}
+	if (settings->state_vid.slices != NULL) {
+		int dct_block_count_x = (settings->video_width+15)/16;
+		for (int fx = 0; fx < dct_block_count_x; fx++) {
+			free(settings->state_vid.slices[fx].frame_output);
+		}
+		free(settings->state_vid.slices);
+		settings->state_vid.slices = NULL;
+	}
+	for (int i = 0; i < 6; i++) {
+		free(settings->state_vid.dct_block_lists[i]);
+		settings->state_vid.dct_block_lists[i] = NULL;
+	}
+}
+
 void encode_sector_str(uint8_t *video_frames, uint8_t *output, settings_t *settings)
 {
 	uint8_t header[32];
@@ -24,6 +24,10 @@ freely, subject to the following restrictions:
 
 #include "common.h"
 
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
 const char *format_names[NUM_FORMATS] = {
 	"xa", "xacd",
 	"spu", "spui",
@@ -32,17 +36,40 @@ const char *format_names[NUM_FORMATS] = {
 	"sbs2"
 };
 
+static bool read_data_file(settings_t *settings, const char *path) {
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		return false;
+	}
+
+	// Chunk indices are 16-bit, so the data has to fit in 65535 sectors.
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if (size < 0 || size > 0xFFFF * 2016L) {
+		fclose(file);
+		return false;
+	}
+
+	settings->data_size = (size_t)size;
+	settings->data = realloc(settings->data, settings->data_size);
+	bool ok = fread(settings->data, 1, settings->data_size, file) == settings->data_size;
+	fclose(file);
+	return ok;
+}
+
 void print_help(void) {
 	fprintf(stderr,
 		"Usage:\n"
 		"    psxavenc -t <xa|xacd>     [-f 18900|37800] [-b 4|8] [-c 1|2] [-F 0-255] [-C 0-31] <in> <out.xa>\n"
-		"    psxavenc -t <str2|str2cd> [-f 18900|37800] [-b 4|8] [-c 1|2] [-F 0-255] [-C 0-31] [-s WxH] [-I] [-r num/den] [-x 1|2] <in> <out.str>\n"
-		"    psxavenc -t sbs2          [-s WxH] [-I] [-r num/den] [-a size] <in> <out.str>\n"
+		"    psxavenc -t <str2|str2cd> [-f 18900|37800] [-b 4|8] [-c 1|2] [-F 0-255] [-C 0-31] [-s WxH] [-I] [-r num/den] [-x 1|2] [-2] [-M words] [-d sectors] [-D file] <in> <out.str>\n"
+		"    psxavenc -t sbs2          [-s WxH] [-I] [-r num/den] [-a size] [-2] [-M words] <in> <out.str>\n"
 		"    psxavenc -t <spu|vag>     [-f freq] [-L] <in> <out.vag>\n"
 		"    psxavenc -t <spui|vagi>   [-f freq] [-c 1-24] [-L] [-i size] [-a size] <in> <out.vag>\n"
 		"\nTool options:\n"
 		"    -h               Show this help message and exit\n"
 		"    -q               Suppress all non-error messages\n"
+		"    -j threads       Use specified number of threads for video encoding (default: one per CPU)\n"
 		"\nOutput options:\n"
 		"    -t format        Use specified output type:\n"
 		"                       xa     [A.] .xa, 2336-byte sectors\n"
@@ -61,6 +88,7 @@ void print_help(void) {
 		"    -b bitdepth      Use specified bit depth for xa/str2 (4 or 8)\n"
 		"    -c channels      Use specified channel count (1-2 for xa/str2, any for spui/vagi)\n"
 		"    -L               Add a loop marker at the end of SPU-ADPCM data\n"
+		"    -Q quality       Use specified ADPCM filter search (exhaustive or fast, default exhaustive)\n"
 		"    -R key=value,... Pass custom options to libswresample (see ffmpeg docs)\n"
 		"\nSPU interleaving options (spui/vagi format):\n"
 		"    -i size          Use specified interleave\n"
@@ -72,13 +100,21 @@ void print_help(void) {
 		"    -r num/den       Set frame rate to specified integer or fraction (default 15)\n"
 		"    -x speed         Set the CD-ROM speed the file is meant to played at (1-2)\n"
 		"    -a size          Set the size of each frame for sbs2\n"
+		"    -2               Measure each frame first and encode it straight at the best fitting\n"
+		"                     quantization scale, instead of trying every scale in turn\n"
+		"    -M words         Limit the decompressed MDEC data of each frame to specified size in\n"
+		"                     32-bit words, to fit the player's buffer (default no limit)\n"
+		"\nData options (str2/str2cd format):\n"
+		"    -d sectors       Reserve specified number of sectors per second for data\n"
+		"    -D file          Put the contents of file into the data sectors, starting from the\n"
+		"                     beginning of the video (the rest are left empty)\n"
 	);
 }
 
 int parse_args(settings_t* settings, int argc, char** argv) {
 	int c, i;
 	char *next;
-	while ((c = getopt(argc, argv, "?hqt:F:C:f:b:c:LR:i:a:s:IS:r:x:")) != -1) {
+	while ((c = getopt(argc, argv, "?hqj:t:F:C:f:b:c:LQ:R:i:a:s:IS:r:x:2M:d:D:")) != -1) {
 		switch (c) {
 			case '?':
 			case 'h': {
@@ -89,6 +125,13 @@ int parse_args(settings_t* settings, int argc, char** argv) {
 				settings->quiet = true;
 				settings->show_progress = false;
 			} break;
+			case 'j': {
+				settings->threads = strtol(optarg, NULL, 0);
+				if (settings->threads < 1) {
+					fprintf(stderr, "Invalid thread count: %d\n", settings->threads);
+					return -1;
+				}
+			} break;
 			case 't': {
 				settings->format = -1;
 				for (i = 0; i < NUM_FORMATS; i++) {
@@ -136,6 +179,16 @@ int parse_args(settings_t* settings, int argc, char** argv) {
 			case 'L': {
 				settings->loop = true;
 			} break;
+			case 'Q': {
+				if (!strcmp(optarg, "exhaustive")) {
+					settings->quality = PSX_AUDIO_ADPCM_EXHAUSTIVE;
+				} else if (!strcmp(optarg, "fast")) {
+					settings->quality = PSX_AUDIO_ADPCM_FAST;
+				} else {
+					fprintf(stderr, "Invalid ADPCM quality: %s\n", optarg);
+					return -1;
+				}
+			} break;
 			case 'R': {
 				settings->swresample_options = optarg;
 			} break;
@@ -201,6 +254,29 @@ int parse_args(settings_t* settings, int argc, char** argv) {
 					return -1;
 				}
 			} break;
+			case 'd': {
+				settings->data_sectors = strtol(optarg, NULL, 0);
+				if (settings->data_sectors < 0) {
+					fprintf(stderr, "Invalid data sector count: %d\n", settings->data_sectors);
+					return -1;
+				}
+			} break;
+			case 'D': {
+				if (!read_data_file(settings, optarg)) {
+					fprintf(stderr, "Could not read data file (or larger than 65535 sectors): %s\n", optarg);
+					return -1;
+				}
+			} break;
+			case '2': {
+				settings->two_pass = true;
+			} break;
+			case 'M': {
+				settings->max_mdec_words = strtol(optarg, NULL, 0);
+				if (settings->max_mdec_words < 0 || settings->max_mdec_words > 0xFFFF) {
+					fprintf(stderr, "Invalid MDEC data size: %d\n", settings->max_mdec_words);
+					return -1;
+				}
+			} break;
 		}
 	}
 
@@ -267,9 +343,31 @@ int parse_args(settings_t* settings, int argc, char** argv) {
 			return -1;
 	}
 
+	if (settings->data_sectors || settings->data_size) {
+		if (settings->format != FORMAT_STR2 && settings->format != FORMAT_STR2CD) {
+			fprintf(stderr, "Data sectors can only be added to str2/str2cd files\n");
+			return -1;
+		}
+		if (!settings->data_sectors) {
+			fprintf(stderr, "Data sectors (-d) must be reserved to store a data file\n");
+			return -1;
+		}
+	}
+
 	return optind;
 }
 
+static int get_cpu_count(void) {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return (count > 0) ? count : 1;
+#endif
+}
+
 int main(int argc, char **argv) {
 	settings_t settings;
 	int arg_offset;
@@ -279,6 +377,7 @@ int main(int argc, char **argv) {
 
 	settings.quiet = false;
 	settings.show_progress = isatty(fileno(stderr));
+	settings.threads = get_cpu_count();
 
 	settings.format = -1;
 	settings.file_number = 0;
@@ -290,6 +389,7 @@ int main(int argc, char **argv) {
 	settings.interleave = 0;
 	settings.alignment = 2048;
 	settings.loop = false;
+	settings.quality = PSX_AUDIO_ADPCM_EXHAUSTIVE;
 
 	// NOTE: ffmpeg/ffplay's .str demuxer has the frame rate hardcoded to 15fps
 	// so if you're messing around with this make sure you test generated files